@@ -0,0 +1,262 @@
+#include "binary.hpp"
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+void write_varint(std::ostream &out, uint64_t value) {
+    while (value >= 0x80) {
+        out.put(static_cast<char>((value & 0x7f) | 0x80));
+        value >>= 7;
+    }
+    out.put(static_cast<char>(value));
+}
+
+uint64_t read_varint(std::istream &in) {
+    uint64_t value = 0;
+    int shift = 0;
+
+    while (true) {
+        int c = in.get();
+        if (c == EOF) {
+            throw std::runtime_error("Unexpected end of input while reading varint");
+        }
+        if (shift >= 64) {
+            throw std::runtime_error("Varint too long");
+        }
+        value |= static_cast<uint64_t>(c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return value;
+        }
+        shift += 7;
+    }
+}
+
+void write_svarint(std::ostream &out, int64_t value) {
+    write_varint(out, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+int64_t read_svarint(std::istream &in) {
+    uint64_t value = read_varint(in);
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+// fixed width values are written little-endian, independent of the host
+void write_u64(std::ostream &out, uint64_t value) {
+    for (int i = 0; i < 8; ++i) {
+        out.put(static_cast<char>((value >> (8 * i)) & 0xff));
+    }
+}
+
+uint64_t read_u64(std::istream &in) {
+    uint64_t value = 0;
+    for (int i = 0; i < 8; ++i) {
+        int c = in.get();
+        if (c == EOF) {
+            throw std::runtime_error("Unexpected end of input while reading u64");
+        }
+        value |= static_cast<uint64_t>(c) << (8 * i);
+    }
+    return value;
+}
+
+void write_f32(std::ostream &out, float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    for (int i = 0; i < 4; ++i) {
+        out.put(static_cast<char>((bits >> (8 * i)) & 0xff));
+    }
+}
+
+float read_f32(std::istream &in) {
+    uint32_t bits = 0;
+    for (int i = 0; i < 4; ++i) {
+        int c = in.get();
+        if (c == EOF) {
+            throw std::runtime_error("Unexpected end of input while reading f32");
+        }
+        bits |= static_cast<uint32_t>(c) << (8 * i);
+    }
+    float value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void write_f64(std::ostream &out, double value) {
+    uint64_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    write_u64(out, bits);
+}
+
+double read_f64(std::istream &in) {
+    uint64_t bits = read_u64(in);
+    double value;
+    std::memcpy(&value, &bits, sizeof(value));
+    return value;
+}
+
+void write_string(std::ostream &out, const std::string &value) {
+    write_varint(out, value.size());
+    out.write(value.data(), value.size());
+}
+
+std::string read_string(std::istream &in) {
+    uint64_t size = read_varint(in);
+    std::string value(size, '\0');
+    if (!in.read(&value[0], size)) {
+        throw std::runtime_error("Unexpected end of input while reading string");
+    }
+    return value;
+}
+
+void write_row(std::ostream &out, const Row &row) {
+    write_svarint(out, row.id);
+    write_string(out, row.datetime_str);
+    write_svarint(out, row.datetime);
+    write_string(out, row.primary_type);
+    write_f32(out, row.lat);
+    write_f32(out, row.lon);
+}
+
+Row read_row(std::istream &in) {
+    Row row;
+    row.id = static_cast<int>(read_svarint(in));
+    row.datetime_str = read_string(in);
+    row.datetime = static_cast<time_t>(read_svarint(in));
+    row.primary_type = read_string(in);
+    row.lat = read_f32(in);
+    row.lon = read_f32(in);
+    return row;
+}
+
+void write_spans(std::ostream &out, const std::vector<VarSpan> &spans) {
+    write_varint(out, spans.size());
+    for (const VarSpan &span : spans) {
+        out.put(span.var);
+        write_varint(out, span.first);
+        write_varint(out, span.last - span.first);
+    }
+}
+
+std::vector<VarSpan> read_spans(std::istream &in) {
+    std::vector<VarSpan> spans;
+    uint64_t count = read_varint(in);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        int var = in.get();
+        if (var == EOF) {
+            throw std::runtime_error("Unexpected end of input while reading spans");
+        }
+        VarSpan span;
+        span.var = static_cast<char>(var);
+        span.first = read_varint(in);
+        span.last = span.first + read_varint(in);
+        spans.push_back(span);
+    }
+    return spans;
+}
+
+static const char MATCH_MAGIC[4] = {'N', 'F', 'A', 'M'};
+static const int MATCH_VERSION = 1;
+
+void write_match_header(std::ostream &out) {
+    out.write(MATCH_MAGIC, sizeof(MATCH_MAGIC));
+    out.put(static_cast<char>(MATCH_VERSION));
+}
+
+void read_match_header(std::istream &in) {
+    char magic[sizeof(MATCH_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), MATCH_MAGIC)) {
+        throw std::runtime_error("Not a match stream");
+    }
+    if (in.get() != MATCH_VERSION) {
+        throw std::runtime_error("Unsupported match stream version");
+    }
+}
+
+void write_aggregate(std::ostream &out, const Aggregate &aggregate) {
+    write_f32(out, aggregate.min);
+    write_f32(out, aggregate.max);
+    write_f64(out, aggregate.sum);
+}
+
+Aggregate read_aggregate(std::istream &in) {
+    Aggregate aggregate;
+    aggregate.min = read_f32(in);
+    aggregate.max = read_f32(in);
+    aggregate.sum = read_f64(in);
+    return aggregate;
+}
+
+void write_match(std::ostream &out, const Match &match) {
+    write_varint(out, match.spans.size());
+    for (const MatchSpan &span : match.spans) {
+        out.put(span.var);
+        write_varint(out, span.first);
+        write_varint(out, span.last - span.first);
+        write_svarint(out, span.first_id);
+        write_svarint(out, span.last_id);
+    }
+
+    write_varint(out, match.measures.vars.size());
+    for (const VarMeasures &var : match.measures.vars) {
+        out.put(var.var);
+        write_varint(out, var.count);
+        write_svarint(out, var.first);
+        write_svarint(out, var.last);
+        write_aggregate(out, var.lat);
+        write_aggregate(out, var.lon);
+    }
+}
+
+Match read_match(std::istream &in) {
+    Match match;
+
+    uint64_t span_count = read_varint(in);
+    for (uint64_t i = 0; i < span_count; ++i) {
+        MatchSpan span;
+        span.var = static_cast<char>(in.get());
+        span.first = read_varint(in);
+        span.last = span.first + read_varint(in);
+        span.first_id = static_cast<int>(read_svarint(in));
+        span.last_id = static_cast<int>(read_svarint(in));
+        match.spans.push_back(span);
+    }
+
+    // the match-wide measures follow from the spans and the per-variable measures
+    Measures &measures = match.measures;
+    uint64_t var_count = read_varint(in);
+    for (uint64_t i = 0; i < var_count; ++i) {
+        VarMeasures var(static_cast<char>(in.get()));
+        var.count = static_cast<int>(read_varint(in));
+        var.first = static_cast<int>(read_svarint(in));
+        var.last = static_cast<int>(read_svarint(in));
+        var.lat = read_aggregate(in);
+        var.lon = read_aggregate(in);
+        measures.count += var.count;
+        measures.vars.push_back(var);
+    }
+    if (!match.spans.empty()) {
+        measures.first = match.spans.front().first_id;
+        measures.last = match.spans.back().last_id;
+    }
+    return match;
+}
+
+std::vector<Match> read_matches(std::istream &in) {
+    read_match_header(in);
+
+    std::vector<Match> matches;
+    while (in.peek() != EOF) {
+        matches.push_back(read_match(in));
+    }
+    return matches;
+}
+
+MatchWriter::MatchWriter(std::ostream &out)
+    : out(out) {
+    write_match_header(out);
+}
+
+void MatchWriter::operator()(const Match &match) {
+    write_match(out, match);
+}
@@ -0,0 +1,56 @@
+#ifndef BINARY_HPP
+#define BINARY_HPP
+
+#include "nfa.hpp"
+#include <iostream>
+#include <cstdint>
+#include <string>
+
+// unsigned LEB128, small indices and counts take a single byte
+void write_varint(std::ostream &out, uint64_t value);
+uint64_t read_varint(std::istream &in);
+
+// zigzag encoded, for values that may be negative
+void write_svarint(std::ostream &out, int64_t value);
+int64_t read_svarint(std::istream &in);
+
+void write_u64(std::ostream &out, uint64_t value);
+uint64_t read_u64(std::istream &in);
+void write_f32(std::ostream &out, float value);
+float read_f32(std::istream &in);
+void write_f64(std::ostream &out, double value);
+double read_f64(std::istream &in);
+void write_string(std::ostream &out, const std::string &value);
+std::string read_string(std::istream &in);
+
+void write_row(std::ostream &out, const Row &row);
+Row read_row(std::istream &in);
+void write_spans(std::ostream &out, const std::vector<VarSpan> &spans);
+std::vector<VarSpan> read_spans(std::istream &in);
+
+/*
+Match stream:
+    stream    ::= "NFAM" version:u8 match*
+    match     ::= span_count:varint span* var_count:varint measures*
+    span      ::= var:u8 first:varint (last - first):varint first_id:svarint last_id:svarint
+    measures  ::= var:u8 count:varint first_id:svarint last_id:svarint lat:aggregate lon:aggregate
+    aggregate ::= min:f32 max:f32 sum:f64
+
+first/last are sequence numbers in the matched stream, counted from its first row in both of
+main's modes, the ids are Row::id of the span's end rows.
+*/
+void write_match_header(std::ostream &out);
+void read_match_header(std::istream &in);
+void write_match(std::ostream &out, const Match &match);
+Match read_match(std::istream &in);
+std::vector<Match> read_matches(std::istream &in);      // header and every match up to the end of the stream
+
+// sink that appends every emitted match to a match stream, writing the header on construction
+struct MatchWriter {
+    std::ostream &out;
+
+    MatchWriter(std::ostream &out);
+    void operator()(const Match &match);
+};
+
+#endif
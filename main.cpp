@@ -1,6 +1,10 @@
 #include "parser.hpp"
 #include "lexer.hpp"
 #include "nfa.hpp"
+#include "reorder.hpp"
+#include "nfa_cache.hpp"
+#include "static_matcher.hpp"
+#include "binary.hpp"
 #include <iostream>
 #include <vector>
 #include <string>
@@ -9,11 +13,19 @@
 #include <iomanip>
 #include <ctime>
 #include <sstream>
+#include <fstream>
 
 #define SHINY_CYAN "\033[1;38;2;0;255;255m"
 #define RESET_COLOR      "\033[0m"
 
 bool after_match_skip_to_next_row = false;
+bool reorder_rows = false;          // sort rows by datetime before matching, rows the sample lists as they arrived
+time_t max_lateness = 40 * 60;     // with reorder_rows: rows arriving more than this behind the newest row are dropped
+std::string match_output = "";      // if set, matches are also written there as a binary match stream
+size_t max_runs = 10000;            // live runs above this are shed, oldest first
+bool use_static_matcher = false;    // streaming mode only: use the compile-time specialized matcher
+
+static constexpr char PATTERN[] = "RZ*BZ*M";
 
 std::vector<Row> rows = {
     {1, "1/2/2018 5:30", 0, "ASSAULT", 41.69, -87.66},
@@ -51,55 +63,97 @@ bool in_range(double a, double b, double range) {
     return std::abs(a - b) <= range + 1e-5;
 }
 
-const Row& get_binding(const std::vector<matchedVar> &buffer, char var) {
-    auto binding = std::find_if(buffer.begin(), buffer.end(),
-        [var](const matchedVar &matchedVar) {
-            return matchedVar.var == var;
-        });
+// B and M have to happen close to the robbery R, M also within half an hour of it.
+// Shared by the per-run, batch and compile-time guards so they cannot drift apart.
+bool near_R(const Row &row, double R_lat, double R_lon) {
+    bool lon_ok = in_range(row.lon, R_lon, 0.05);
+    bool lat_ok = in_range(row.lat, R_lat, 0.02);
 
-    return *binding->row;
+    return lon_ok && lat_ok;
 }
 
-GuardFn wildcard = [] (const std::vector<matchedVar> &buffer, const Row &row) {
-    return true;
+bool soon_after_R(const Row &row, time_t R_datetime) {
+    return std::abs(row.datetime - R_datetime) <= 30 * 60;
+}
+
+// guard types for the compile-time matcher, the GuardFn versions below wrap the same checks
+struct GuardR {
+    static constexpr char var = 'R';
+
+    static bool check(const BindingView &bindings, const Row &R) {
+        return R.primary_type == "ROBBERY";
+    }
 };
 
-GuardFn guard_R = [] (const std::vector<matchedVar> &buffer, const Row &R) {
-    return R.primary_type == "ROBBERY";
+struct GuardB {
+    static constexpr char var = 'B';
+
+    static bool check(const BindingView &bindings, const Row &B) {
+        if (B.primary_type != "BATTERY") {
+            return false;
+        };
+        const Row &R = *bindings.first('R');
+
+        return near_R(B, R.lat, R.lon);
+    }
 };
 
-GuardFn guard_B = [] (const std::vector<matchedVar> &buffer, const Row &B) {
-    if (B.primary_type != "BATTERY") {
-        return false;
-    };
-    const Row &R = get_binding(buffer, 'R');
+struct GuardM {
+    static constexpr char var = 'M';
 
-    bool lon_ok = in_range(B.lon, R.lon, 0.05);
-    bool lat_ok = in_range(B.lat, R.lat, 0.02);
+    static bool check(const BindingView &bindings, const Row &M) {
+        if (M.primary_type != "MOTOR VEHICLE THEFT") {
+            return false;
+        };
+        const Row &R = *bindings.first('R');
 
-    return lon_ok && lat_ok;
+        return near_R(M, R.lat, R.lon) && soon_after_R(M, R.datetime);
+    }
 };
 
-GuardFn guard_M = [] (const std::vector<matchedVar> &buffer, const Row &M) {
-    if (M.primary_type != "MOTOR VEHICLE THEFT") {
-        return false;
-    };
-    const Row &R = get_binding(buffer, 'R');
-    bool lon_ok = in_range(M.lon, R.lon, 0.05);
-    bool lat_ok = in_range(M.lat, R.lat, 0.02);
+GuardFn wildcard = [] (const BindingView &bindings, const Row &row) {
+    return true;
+};
 
-    bool within = std::abs(M.datetime - R.datetime) <= 30 * 60;
+GuardFn guard_R = GuardR::check;
+GuardFn guard_B = GuardB::check;
+GuardFn guard_M = GuardM::check;
 
-    return lon_ok && lat_ok && within;
+// batch versions of guard_B and guard_M, the checks run over all runs waiting at the same state
+BatchGuardFn batch_guard_B = [] (const Row &B, const BoundColumns &R, std::vector<char> &pass) {
+    if (B.primary_type != "BATTERY") {
+        return;
+    }
+    for (size_t i = 0; i < R.size(); ++i) {
+        pass[i] = near_R(B, R.lat[i], R.lon[i]);
+    }
+};
+
+BatchGuardFn batch_guard_M = [] (const Row &M, const BoundColumns &R, std::vector<char> &pass) {
+    if (M.primary_type != "MOTOR VEHICLE THEFT") {
+        return;
+    }
+    for (size_t i = 0; i < R.size(); ++i) {
+        pass[i] = near_R(M, R.lat[i], R.lon[i]) && soon_after_R(M, R.datetime[i]);
+    }
+};
+
+// ids are stored in compiled NFAs, bump GUARD_DEFS whenever a guard or its batch version changes meaning
+GuardTable guards = {
+    wildcard,
+    guard_R,
+    {guard_B, batch_guard_B, 'R'},
+    {guard_M, batch_guard_M, 'R'}
 };
+const std::string GUARD_DEFS = "wildcard,R:robbery,B:battery near R (batch over R),M:vehicle theft near R within 30min (batch over R)";
 
-GuardFn guard_for_var(char var) {
+int guard_id_for_var(char var) {
     switch (var) {
-        case 'R': return guard_R;
-        case 'B': return guard_B;
-        case 'M': return guard_M;
-        case 'Z': return wildcard;
-        default:  return wildcard;
+        case 'R': return 1;
+        case 'B': return 2;
+        case 'M': return 3;
+        case 'Z': return 0;
+        default:  return 0;
     }
 }
 
@@ -109,23 +163,68 @@ int main() {
         row.datetime = date;
     }
 
-    std::string pattern = "RZ*BZ*M";
+    if (reorder_rows) {
+        std::vector<Row> ordered;
+        Reorderer reorderer(max_lateness, [&ordered](const Row &row) {
+            ordered.push_back(row);
+        });
+        for (const Row &row : rows) {
+            if (!reorderer.push(row)) {
+                std::cout << "Late ROW " << row.id << " (" << row.datetime_str << ") dropped\n";
+            }
+        }
+        reorderer.flush();
+        rows = std::move(ordered);
+    }
+
+    std::string pattern = PATTERN;
+
+    NFA nfa = compile_cached(".nfa_cache", pattern, GUARD_DEFS, guard_id_for_var, guards);
 
-    Lexer lexer(pattern);
-    Parser parser(lexer);
-    Node* ast = parser.parse_pattern();
-    NFA nfa = build_from_AST(ast);
-    delete(ast);
+    std::ofstream match_file;
+    MatchSink sink = print_match;
+    if (!match_output.empty()) {
+        match_file.open(match_output, std::ios::binary | std::ios::trunc);
+        MatchWriter writer(match_file);
+        sink = [writer](const Match &match) mutable {
+            print_match(match);
+            writer(match);
+        };
+    }
+
+    if (after_match_skip_to_next_row && use_static_matcher) {
+        StaticMatcher<PATTERN, GuardR, GuardB, GuardM> matcher;
+        matcher.sink = sink;
+        matcher.maxRuns = max_runs;
+        for (const Row &row : rows) {
+            matcher.push(row);
+        }
+        return 0;
+    }
 
-    for (State &state : nfa.states) {
-        if (state.out1.type == TransitionType::VAR)
-            state.out1.guard = guard_for_var(state.out1.var);
+    if (after_match_skip_to_next_row) {
+        // one pass over the stream, the row buffer only keeps rows of live runs
+        Simulation sim(nfa);
+        sim.sink = sink;
+        sim.maxRuns = max_runs;
+        for (const Row &row : rows) {
+            sim.push(row);
+        }
+        return 0;
     }
 
+    // each window starts its row buffer at the window's position in the stream,
+    // so emitted sequence numbers mean the same as in streaming mode
+    uint64_t consumed = 0;
     while(!rows.empty()) {
         std::cout << SHINY_CYAN << "Starting from ROW " << rows.begin()->id << RESET_COLOR << "\n";
         Simulation sim(nfa);
+        sim.rows.reset(consumed);
+        sim.sink = sink;
+        sim.maxRuns = max_runs;
+        size_t before = rows.size();
         sim.find_matches(sim, rows, after_match_skip_to_next_row);
+        consumed += before - rows.size();
     }
   
     return 0;
@@ -2,6 +2,8 @@
 #include <queue>
 #include "nfa.hpp"
 #include <string>
+#include <limits>
+#include <algorithm>
 
 #define SHINY_RED "\033[1;38;2;255;0;0m"
 #define SHINY_GREEN "\033[1;38;2;0;255;0m"
@@ -9,10 +11,10 @@
 
 
 Transition::Transition()
-    : type(TransitionType::NONE), to(-1), var(0), guard(GuardFn()) {}
+    : type(TransitionType::NONE), to(-1), var(0), guard(GuardFn()), guard_id(-1), batch_guard(), batch_var(0) {}
 
 Transition::Transition(TransitionType type, int to, char var, GuardFn guard)
-    : type(type), to(to), var(var), guard(guard) {}
+    : type(type), to(to), var(var), guard(guard), guard_id(-1), batch_guard(), batch_var(0) {}
 
 State::State(int id)
     : id(id), out1(), out2() {}
@@ -227,6 +229,57 @@ void print_transition(const Transition &trans) {
     }
 }
 
+// minimal number of rows a run in each state still has to consume to reach the accept state
+std::vector<int> NFA::distances_to_accept() const {
+    const int unreachable = std::numeric_limits<int>::max();
+    std::vector<int> distances(states.size(), unreachable);
+    if (accept >= 0) {
+        distances[accept] = 0;
+    }
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (const State &state : states) {
+            for (const Transition *trans : {&state.out1, &state.out2}) {
+                if (trans->type == TransitionType::NONE || distances[trans->to] == unreachable) {
+                    continue;
+                }
+                int distance = distances[trans->to] + (trans->type == TransitionType::VAR ? 1 : 0);
+                if (distance < distances[state.id]) {
+                    distances[state.id] = distance;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return distances;
+}
+
+// FNV-1a over the structure of the automaton and its guard ids
+uint64_t NFA::fingerprint() const {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](int64_t value) {
+        for (int i = 0; i < 8; ++i) {
+            hash ^= static_cast<uint64_t>(value >> (8 * i)) & 0xff;
+            hash *= 1099511628211ull;
+        }
+    };
+
+    mix(start);
+    mix(accept);
+    mix(states.size());
+    for (const State &state : states) {
+        for (const Transition *trans : {&state.out1, &state.out2}) {
+            mix(static_cast<int>(trans->type));
+            mix(trans->to);
+            mix(trans->var);
+            mix(trans->guard_id);
+        }
+    }
+    return hash;
+}
+
 void NFA::print() const {
     std::cout << "Start state: " << start << "\n";
     std::cout << "Accept state: " << accept << "\n";
@@ -248,11 +301,231 @@ void NFA::print() const {
     }
 }
 
+size_t row_memory(const Row &row) {
+    return sizeof(Row) + row.datetime_str.size() + row.primary_type.size();
+}
+
+RowBuffer::RowBuffer()
+    : ring(MIN_CAPACITY), pushed_before(MIN_CAPACITY), head(0), tail(0), bytes(0), pushed_bytes(0) {}
+
+// moves the retained rows into a ring of the given capacity, which has to hold all of them
+void RowBuffer::resize(size_t capacity) {
+    std::vector<Row> resized(capacity);
+    std::vector<uint64_t> resized_before(capacity);
+    for (uint64_t seq = head; seq < tail; ++seq) {
+        resized[seq & (capacity - 1)] = std::move(ring[seq & (ring.size() - 1)]);
+        resized_before[seq & (capacity - 1)] = pushed_before[seq & (ring.size() - 1)];
+    }
+    ring = std::move(resized);
+    pushed_before = std::move(resized_before);
+}
+
+uint64_t RowBuffer::push(const Row &row) {
+    if (size() == ring.size()) {
+        resize(ring.size() * 2);
+    }
+    size_t memory = row_memory(row);
+    ring[tail & (ring.size() - 1)] = row;
+    pushed_before[tail & (ring.size() - 1)] = pushed_bytes;
+    pushed_bytes += memory;
+    bytes += memory;
+    return tail++;
+}
+
+const Row& RowBuffer::at(uint64_t seq) const {
+    if (seq < head || seq >= tail) {
+        throw std::runtime_error("Row " + std::to_string(seq) + " is no longer retained");
+    }
+    return ring[seq & (ring.size() - 1)];
+}
+
+void RowBuffer::release_before(uint64_t seq) {
+    if (seq > tail) {
+        seq = tail;
+    }
+    // drop the released rows' strings now instead of when their slot is reused
+    for (; head < seq; ++head) {
+        Row &released = ring[head & (ring.size() - 1)];
+        bytes -= row_memory(released);
+        released = Row();
+    }
+
+    // halve the ring after a burst, so it follows the live rows back down
+    size_t capacity = ring.size();
+    while (capacity > MIN_CAPACITY && size() < capacity / 4) {
+        capacity /= 2;
+    }
+    if (capacity != ring.size()) {
+        resize(capacity);
+    }
+}
+
+// empties the buffer, the next pushed row gets sequence number seq
+void RowBuffer::reset(uint64_t seq) {
+    ring = std::vector<Row>(MIN_CAPACITY);
+    pushed_before = std::vector<uint64_t>(MIN_CAPACITY);
+    head = seq;
+    tail = seq;
+    bytes = 0;
+    pushed_bytes = 0;
+}
+
+size_t RowBuffer::size() const {
+    return tail - head;
+}
+
+// the ring's empty slots are not counted, release_before keeps them below three quarters of the ring
+size_t RowBuffer::memory() const {
+    return bytes;
+}
+
+// row_memory of the retained rows from sequence number seq on, in constant time
+size_t RowBuffer::memory_from(uint64_t seq) const {
+    if (seq <= head) {
+        return bytes;
+    }
+    if (seq >= tail) {
+        return 0;
+    }
+    return pushed_bytes - pushed_before[seq & (ring.size() - 1)];
+}
+
+void BoundColumns::clear() {
+    lat.clear();
+    lon.clear();
+    datetime.clear();
+}
+
+// an unbound variable yields NaN coordinates, which fail every range check
+void BoundColumns::add(const Row *row) {
+    lat.push_back(row ? row->lat : std::numeric_limits<float>::quiet_NaN());
+    lon.push_back(row ? row->lon : std::numeric_limits<float>::quiet_NaN());
+    datetime.push_back(row ? row->datetime : 0);
+}
+
+size_t BoundColumns::size() const {
+    return lat.size();
+}
+
+BindingView::BindingView(const std::vector<VarSpan> &spans, const RowBuffer &rows)
+    : spans(spans), rows(rows) {}
+
+const Row* BindingView::first(char var) const {
+    for (const VarSpan &span : spans) {
+        if (span.var == var) {
+            return &rows.at(span.first);
+        }
+    }
+    return nullptr;
+}
+
+const Row* BindingView::last(char var) const {
+    for (auto span = spans.rbegin(); span != spans.rend(); ++span) {
+        if (span->var == var) {
+            return &rows.at(span->last);
+        }
+    }
+    return nullptr;
+}
+
+Aggregate::Aggregate()
+    : min(std::numeric_limits<float>::max()), max(std::numeric_limits<float>::lowest()), sum(0) {}
+
+void Aggregate::add(float value) {
+    if (value < min) min = value;
+    if (value > max) max = value;
+    sum += value;
+}
+
+VarMeasures::VarMeasures(char var)
+    : var(var), count(0), first(-1), last(-1), lat(), lon() {}
+
+void VarMeasures::add(const Row &row) {
+    if (count == 0) {
+        first = row.id;
+    }
+    last = row.id;
+    count++;
+    lat.add(row.lat);
+    lon.add(row.lon);
+}
+
+double VarMeasures::avg_lat() const {
+    return count == 0 ? 0 : lat.sum / count;
+}
+
+double VarMeasures::avg_lon() const {
+    return count == 0 ? 0 : lon.sum / count;
+}
+
+Measures::Measures()
+    : count(0), first(-1), last(-1), vars() {}
+
+void Measures::add(char var, const Row &row) {
+    if (count == 0) {
+        first = row.id;
+    }
+    last = row.id;
+    count++;
+
+    for (VarMeasures &varMeasures : vars) {
+        if (varMeasures.var == var) {
+            varMeasures.add(row);
+            return;
+        }
+    }
+    vars.emplace_back(var);
+    vars.back().add(row);
+}
+
+const VarMeasures* Measures::get(char var) const {
+    for (const VarMeasures &varMeasures : vars) {
+        if (varMeasures.var == var) {
+            return &varMeasures;
+        }
+    }
+    return nullptr;
+}
+
+void print_match(const Match &match) {
+    const Measures &measures = match.measures;
+
+    std::cout << "\n" << SHINY_GREEN << "=============== MATCH ===============" << RESET_COLOR << "\n\n";
+    std::cout << "Rows " << measures.first << " .. " << measures.last << " (" << measures.count << " rows)\n";
+
+    for (const VarMeasures &var : measures.vars) {
+        std::cout << var.var << ": count=" << var.count
+                  << " first=" << var.first << " last=" << var.last
+                  << " lat=[" << var.lat.min << ", " << var.lat.max << "] avg " << var.avg_lat()
+                  << " lon=[" << var.lon.min << ", " << var.lon.max << "] avg " << var.avg_lon() << "\n";
+    }
+}
+
 Run::Run(int state)
-    : state(state), bindings() {}
+    : state(state), bindings(), measures() {}
+
+void Run::bind(char var, uint64_t seq, const Row &row) {
+    // runs consume every row, so a repeated variable always extends the last span
+    if (!bindings.empty() && bindings.back().var == var && bindings.back().last + 1 == seq) {
+        bindings.back().last = seq;
+    } else {
+        bindings.push_back({var, seq, seq});
+    }
+    measures.add(var, row);
+}
+
+uint64_t Run::start_seq(uint64_t next_seq) const {
+    return bindings.empty() ? next_seq : bindings.front().first;
+}
+
+size_t Run::memory() const {
+    return sizeof(Run) + bindings.capacity() * sizeof(VarSpan) + measures.vars.capacity() * sizeof(VarMeasures);
+}
 
 Simulation::Simulation(const NFA &nfa)
-    : nfa(nfa) {
+    : nfa(nfa), rows(), matchCount(0), shortestMatch(0),
+      maxRuns(0), memoryBudget(0), shedPolicy(ShedPolicy::OLDEST_FIRST), shedCount(0),
+      distanceToAccept(nfa.distances_to_accept()), trace(true), groups(nfa.states.size()) {
         Run Run(nfa.start);
         currentRuns.push_back(Run);
         epsilon_closure(currentRuns);
@@ -269,7 +542,9 @@ bool run_exists(const Run &run, const std::vector<Run> &currentRuns) {
 
         bool exists = true;
         for (size_t i = 0; i < run.bindings.size(); ++i) {
-            if (r.bindings[i].var != run.bindings[i].var || r.bindings[i].row->id != run.bindings[i].row->id) {
+            const VarSpan &a = r.bindings[i];
+            const VarSpan &b = run.bindings[i];
+            if (a.var != b.var || a.first != b.first || a.last != b.last) {
                 exists = false;
                 break;
             }
@@ -281,6 +556,29 @@ bool run_exists(const Run &run, const std::vector<Run> &currentRuns) {
     return false;
 }
 
+Match make_match(const Run &run, const RowBuffer &rows) {
+    Match match;
+    for (const VarSpan &span : run.bindings) {
+        match.spans.push_back({span.var, span.first, span.last, rows.at(span.first).id, rows.at(span.last).id});
+    }
+    match.measures = run.measures;
+    return match;
+}
+
+void Simulation::emit(const Run &run) {
+    size_t length = run.measures.count;
+    if (matchCount == 0 || length < shortestMatch) {
+        shortestMatch = length;
+    }
+    matchCount++;
+
+    if (sink) {
+        sink(make_match(run, rows));
+    } else {
+        accRuns.push_back(run);
+    }
+}
+
 void Simulation::epsilon_closure(std::vector<Run> &currentRuns) {
     std::queue<Run> q;
 
@@ -298,7 +596,7 @@ void Simulation::epsilon_closure(std::vector<Run> &currentRuns) {
         const State &state = nfa.states[id];
 
         if (run.state == nfa.accept) {
-            accRuns.push_back(run);
+            emit(run);
         } if (state.out1.type == TransitionType::VAR) {
             if (!run_exists(run, currentRuns)) {
                 currentRuns.push_back(run);
@@ -321,71 +619,259 @@ void Simulation::print_run(const Run &run) {
     } else {
         std::cout << "Run: state=" << run.state << ", bindings=[";
 
-        for (size_t i = 0; i < run.bindings.size() - 1; ++i) {
-            std::cout << run.bindings[i].var  << ":" << run.bindings[i].row->id << " ";
+        for (size_t i = 0; i < run.bindings.size(); ++i) {
+            const VarSpan &span = run.bindings[i];
+            std::cout << span.var << ":" << rows.at(span.first).id;
+            if (span.last != span.first) {
+                std::cout << "-" << rows.at(span.last).id;
+            }
+            std::cout << (i + 1 < run.bindings.size() ? " " : "]\n");
         }
-
-        size_t last = run.bindings.size() - 1;
-        std::cout << run.bindings[last].var << ":" << run.bindings[last].row->id << "]\n";
     }
 }
 
 void Simulation::print_results(bool match) {
     if (!match) {
             std::cout << "\n" << SHINY_RED << "=== EMPTY ===" << RESET_COLOR <<"\n\n";
-        } else {
+        } else if (!accRuns.empty()) {
             std::cout << "\n" << SHINY_GREEN << "=============== RESULT ===============" << RESET_COLOR << "\n\n";
             for (const Run &accRun : accRuns) {
-                for (const matchedVar &matchedVar : accRun.bindings) {
-                    std::cout << matchedVar.var << " -> Row " << matchedVar.row->id << "\n";
+                for (const VarSpan &span : accRun.bindings) {
+                    if (span.first == span.last) {
+                        std::cout << span.var << " -> Row " << rows.at(span.first).id << "\n";
+                    } else {
+                        std::cout << span.var << " -> Rows " << rows.at(span.first).id << " .. " << rows.at(span.last).id << "\n";
+                    }
                 }
                 std::cout << "\n";
             }
         }
 }
 
-bool Simulation::run(const std::vector<Row> &rows) {
-    for (const Row &row : rows) {
+// groups the live runs by state, so a batch guard is called once per state instead of once per run
+void Simulation::evaluate_guards(const Row &row, std::vector<char> &passed) {
+    passed.assign(currentRuns.size(), 0);
+
+    for (size_t i = 0; i < currentRuns.size(); ++i) {
+        groups[currentRuns[i].state].push_back(i);
+    }
+
+    for (size_t id = 0; id < groups.size(); ++id) {
+        std::vector<size_t> &group = groups[id];
+        const Transition &trans = nfa.states[id].out1;
+
+        if (group.empty() || (int)id == nfa.accept || trans.type != TransitionType::VAR) {
+            group.clear();
+            continue;
+        }
+
+        if (trans.batch_guard) {
+            bound.clear();
+            for (size_t i : group) {
+                bound.add(BindingView(currentRuns[i].bindings, rows).first(trans.batch_var));
+            }
+            pass.assign(group.size(), 0);
+            trans.batch_guard(row, bound, pass);
+            for (size_t k = 0; k < group.size(); ++k) {
+                passed[group[k]] = pass[k];
+            }
+        } else {
+            for (size_t i : group) {
+                passed[i] = trans.guard(BindingView(currentRuns[i].bindings, rows), row);
+            }
+        }
+        group.clear();
+    }
+}
+
+bool Simulation::step(const Row &row) {
+    uint64_t seq = rows.push(row);
+    if (trace) {
         std::cout << "\nROW " << row.id << " (" << row.primary_type << ")\n";
+    }
 
-        std::vector<Run> nextRuns;
+    std::vector<Run> nextRuns;
+    std::vector<char> passed;
+    evaluate_guards(rows.at(seq), passed);
 
-        for (Run run : currentRuns) {
+    for (size_t i = 0; i < currentRuns.size(); ++i) {
+        Run run = currentRuns[i];
+        if (trace) {
             print_run(run);
+        }
 
-            int id = run.state;
-            const State &state = nfa.states[id];
+        int id = run.state;
+        const State &state = nfa.states[id];
 
-            if (run.state == nfa.accept) {
-                accRuns.push_back(run);  
-                continue;                 
-            }
+        if (run.state == nfa.accept) {
+            emit(run);
+            continue;                 
+        }
 
-            if (state.out1.type == TransitionType::VAR) {
-                if (state.out1.guard(run.bindings, row)) {
+        if (state.out1.type == TransitionType::VAR) {
+            if (passed[i]) {
+                if (trace) {
                     std::cout << state.out1.var << " -> " << state.out1.to << " accepted\n";
+                }
+
+                run.state = state.out1.to;
+                run.bind(state.out1.var, seq, row);
+
+                nextRuns.push_back(run); 
+            } else if (trace) {
+                std::cout << state.out1.var << " -> " << state.out1.to << " rejected\n";
+            }
+        } 
+    }
+    epsilon_closure(nextRuns);
+    currentRuns = std::move(nextRuns);
+    shed();
+    reclaim();
+
+    return !currentRuns.empty();
+}
+
+// streaming entry point: starts a new run at every row, so matches from all start rows are found in one pass
+void Simulation::push(const Row &row) {
+    std::vector<Run> seed = {Run(nfa.start)};
+    epsilon_closure(seed);
+    for (const Run &run : seed) {
+        if (!run_exists(run, currentRuns)) {
+            currentRuns.push_back(run);
+        }
+    }
+    step(row);
+}
 
-                    run.state = state.out1.to;
+size_t Simulation::memory() const {
+    size_t memory = rows.memory();
+    for (const Run &run : currentRuns) {
+        memory += run.memory();
+    }
+    return memory;
+}
 
-                    matchedVar matchedVar;
-                    matchedVar.var = state.out1.var;
-                    matchedVar.row = &row; 
-                    run.bindings.push_back(matchedVar);
+// keeps the most promising runs according to policy, see Simulation::shed.
+// A run's cost is its own memory plus the rows it keeps retained, which are only freed once
+// every run that started at or before them is gone.
+size_t shed_runs(std::vector<Run> &runs, const std::vector<Run> &accRuns, const RowBuffer &rows,
+                 size_t maxRuns, size_t memoryBudget, ShedPolicy policy, const std::vector<int> &distanceToAccept) {
+    uint64_t next = rows.tail;
+    auto retained = [&rows](uint64_t oldest) {
+        return rows.memory_from(oldest);
+    };
+
+    size_t memory = 0;
+    if (memoryBudget > 0) {
+        for (const Run &run : runs) {
+            memory += run.memory();
+        }
+    }
 
-                    nextRuns.push_back(run); 
-                } else {
-                    std::cout << state.out1.var << " -> " << state.out1.to << " rejected\n";
+    // counting every retained row is an upper bound, nothing to do when even that fits
+    bool under_runs = maxRuns == 0 || runs.size() <= maxRuns;
+    if (under_runs && (memoryBudget == 0 || memory + rows.memory() <= memoryBudget)) {
+        return 0;
+    }
+
+    uint64_t pinned = next;     // stored accepted runs cannot be shed
+    if (memoryBudget > 0) {
+        for (const Run &run : accRuns) {
+            pinned = std::min(pinned, run.start_seq(next));
+        }
+        uint64_t oldest = pinned;
+        for (const Run &run : runs) {
+            oldest = std::min(oldest, run.start_seq(next));
+        }
+        memory += retained(oldest);
+    }
+
+    bool over_runs = maxRuns > 0 && runs.size() > maxRuns;
+    bool over_memory = memoryBudget > 0 && memory > memoryBudget;
+    if (!over_runs && !over_memory) {
+        return 0;
+    }
+
+    auto newer = [next](const Run &a, const Run &b) {
+        return a.start_seq(next) > b.start_seq(next);
+    };
+
+    // order runs from most to least worth keeping, the tail gets shed
+    switch (policy) {
+        case ShedPolicy::OLDEST_FIRST:
+            std::stable_sort(runs.begin(), runs.end(), newer);
+            break;
+        case ShedPolicy::LOWEST_PROGRESS_FIRST:
+            std::stable_sort(runs.begin(), runs.end(), [&newer](const Run &a, const Run &b) {
+                if (a.measures.count != b.measures.count) {
+                    return a.measures.count > b.measures.count;
                 }
-            } 
+                return newer(a, b);
+            });
+            break;
+        case ShedPolicy::FARTHEST_FROM_ACCEPT:
+            std::stable_sort(runs.begin(), runs.end(), [&distanceToAccept, &newer](const Run &a, const Run &b) {
+                int da = distanceToAccept[a.state];
+                int db = distanceToAccept[b.state];
+                if (da != db) {
+                    return da < db;
+                }
+                return newer(a, b);
+            });
+            break;
+    }
+
+    size_t keep = runs.size();
+    if (maxRuns > 0 && keep > maxRuns) {
+        keep = maxRuns;
+    }
+
+    // the cost of keeping a prefix only grows with its length, so keep the longest one within budget
+    if (memoryBudget > 0) {
+        size_t runs_memory = 0;
+        uint64_t oldest = pinned;
+        size_t fits = 0;
+        for (size_t i = 0; i < keep; ++i) {
+            runs_memory += runs[i].memory();
+            oldest = std::min(oldest, runs[i].start_seq(next));
+            if (runs_memory + retained(oldest) > memoryBudget) {
+                break;
+            }
+            fits = i + 1;
         }
-        epsilon_closure(nextRuns);
-        currentRuns = std::move(nextRuns);
-        if (currentRuns.empty()) {
+        keep = fits;
+    }
+
+    size_t dropped = runs.size() - keep;
+    runs.resize(keep);
+    return dropped;
+}
+
+// enforces maxRuns and memoryBudget by dropping the least promising runs according to shedPolicy
+void Simulation::shed() {
+    shedCount += shed_runs(currentRuns, accRuns, rows, maxRuns, memoryBudget, shedPolicy, distanceToAccept);
+}
+
+// drops every row older than the first row of the oldest live (or stored accepted) run
+void Simulation::reclaim() {
+    uint64_t oldest = rows.tail;
+    for (const Run &run : currentRuns) {
+        oldest = std::min(oldest, run.start_seq(rows.tail));
+    }
+    for (const Run &run : accRuns) {
+        oldest = std::min(oldest, run.start_seq(rows.tail));
+    }
+    rows.release_before(oldest);
+}
+
+bool Simulation::run(const std::vector<Row> &rows) {
+    for (const Row &row : rows) {
+        if (!step(row)) {
             break;
         }
     }
     
-    bool match = !accRuns.empty();
+    bool match = matchCount > 0;
     return match;
 }
 
@@ -395,16 +881,10 @@ void Simulation::find_matches(Simulation &sim, std::vector<Row> &rows, bool afte
     if (after_match_skip_to_next_row) {
         rows.erase(rows.begin());
     } else {
-        if (sim.accRuns.empty()) {
+        if (sim.matchCount == 0) {
             rows.erase(rows.begin());
         } else {
-            size_t match_length = sim.accRuns.front().bindings.size();
-            for (const Run &run : sim.accRuns) {
-                if (run.bindings.size() < match_length) {
-                    match_length = run.bindings.size();
-                }
-            }
-            rows.erase(rows.begin(), rows.begin()+match_length);
+            rows.erase(rows.begin(), rows.begin()+sim.shortestMatch);
         }
     } 
     sim.reset();
@@ -413,6 +893,10 @@ void Simulation::find_matches(Simulation &sim, std::vector<Row> &rows, bool afte
 void Simulation::reset() {
     currentRuns.clear();
     accRuns.clear();
+    rows.release_before(rows.tail);
+    matchCount = 0;
+    shortestMatch = 0;
+    shedCount = 0;
     Run startRun;
     startRun.state = nfa.start;
     startRun.bindings.clear();
@@ -6,6 +6,7 @@
 #include <functional>
 #include <set>
 #include <ctime>
+#include <cstdint>
 
 struct Row {
     int id;
@@ -16,9 +17,46 @@ struct Row {
     float lon;
 };
 
-struct matchedVar {
+// estimated bytes a retained row costs, its strings included
+size_t row_memory(const Row &row);
+
+// ring buffer of the rows that live runs can still reference, addressed by sequence number
+struct RowBuffer {
+    static const size_t MIN_CAPACITY = 16;
+
+    std::vector<Row> ring;      // capacity is always a power of two
+    std::vector<uint64_t> pushed_before;    // per slot: pushed_bytes when that row was pushed
+    uint64_t head;              // sequence number of the oldest retained row
+    uint64_t tail;              // sequence number the next pushed row gets
+    size_t bytes;               // row_memory of all retained rows
+    uint64_t pushed_bytes;      // row_memory of every row pushed since the last reset
+
+    RowBuffer();
+    void resize(size_t capacity);
+    uint64_t push(const Row &row);
+    const Row& at(uint64_t seq) const;
+    void release_before(uint64_t seq);
+    void reset(uint64_t seq);
+    size_t size() const;
+    size_t memory() const;
+    size_t memory_from(uint64_t seq) const;
+};
+
+// consecutive rows bound to the same variable, as sequence numbers into the row buffer
+struct VarSpan {
     char var;
-    const Row* row; 
+    uint64_t first;
+    uint64_t last;
+};
+
+// read-only view of a run's spans over the row buffer, handed to guards
+struct BindingView {
+    const std::vector<VarSpan> &spans;
+    const RowBuffer &rows;
+
+    BindingView(const std::vector<VarSpan> &spans, const RowBuffer &rows);
+    const Row* first(char var) const;
+    const Row* last(char var) const;
 };
 
 enum class TransitionType {
@@ -27,13 +65,30 @@ enum class TransitionType {
     EPSILON   
 };
 
-using GuardFn = std::function<bool(const std::vector<matchedVar>&, const Row&)>;
+using GuardFn = std::function<bool(const BindingView&, const Row&)>;
+
+// columns of the rows bound to one variable, one entry per run waiting at the same state
+struct BoundColumns {
+    std::vector<float> lat;
+    std::vector<float> lon;
+    std::vector<time_t> datetime;
+
+    void clear();
+    void add(const Row *row);
+    size_t size() const;
+};
+
+// evaluates a guard for a whole group of runs at once, pass[i] is set for the i-th run
+using BatchGuardFn = std::function<void(const Row&, const BoundColumns&, std::vector<char> &pass)>;
 
 struct Transition {
     TransitionType type;
     int to;
     char var;
     GuardFn guard;
+    int guard_id;       // index into the caller's guard table, -1 if the guard was attached directly
+    BatchGuardFn batch_guard;   // if set, used instead of guard
+    char batch_var;             // variable whose first bound row fills the BoundColumns
 
     Transition();
     Transition(TransitionType type, int to, char var = 0, GuardFn guard = GuardFn());
@@ -69,28 +124,126 @@ struct NFA {
     NFA build_union_NFA(NFA nfa1, NFA nfa2);
     NFA build_concat_NFA(NFA nfa1, NFA nfa2);
 
+    std::vector<int> distances_to_accept() const;
+    uint64_t fingerprint() const;
     void print() const; 
 };
 
 NFA build_from_AST(Node* ast);
 
+// running min/max/sum of one numeric row field, updated as rows bind
+struct Aggregate {
+    float min;
+    float max;
+    double sum;
+
+    Aggregate();
+    void add(float value);
+};
+
+struct VarMeasures {
+    char var;
+    int count;
+    int first;      // id of the first row bound to var
+    int last;       // id of the last row bound to var
+    Aggregate lat;
+    Aggregate lon;
+
+    VarMeasures(char var = 0);
+    void add(const Row &row);
+    double avg_lat() const;
+    double avg_lon() const;
+};
+
+struct Measures {
+    int count;
+    int first;
+    int last;
+    std::vector<VarMeasures> vars;     // one entry per variable, in order of first binding
+
+    Measures();
+    void add(char var, const Row &row);
+    const VarMeasures* get(char var) const;
+};
+
+// a span of an emitted match, with the ids of its first and last row resolved
+struct MatchSpan {
+    char var;
+    uint64_t first;     // sequence numbers of the row buffer, stream-wide if it was reset to the window's offset
+    uint64_t last;
+    int first_id;
+    int last_id;
+};
+
+struct Match {
+    std::vector<MatchSpan> spans;
+    Measures measures;
+};
+
+using MatchSink = std::function<void(const Match&)>;
+
+void print_match(const Match &match);
+
 struct Run {
     int state;
-    std::vector<matchedVar> bindings;
+    std::vector<VarSpan> bindings;    // one entry per pattern segment, not per row
+    Measures measures;
 
     Run(int state = 0);
+    void bind(char var, uint64_t seq, const Row &row);
+    uint64_t start_seq(uint64_t next_seq) const;
+    size_t memory() const;
 };
 
+Match make_match(const Run &run, const RowBuffer &rows);
+
+bool run_exists(const Run &run, const std::vector<Run> &currentRuns);
+
+// which live runs are dropped first once a limit is exceeded
+enum class ShedPolicy {
+    OLDEST_FIRST,
+    LOWEST_PROGRESS_FIRST,
+    FARTHEST_FROM_ACCEPT
+};
+
+// drops runs until maxRuns and memoryBudget hold (0 = unlimited), returns how many were dropped.
+// distanceToAccept is indexed by run state and only used by FARTHEST_FROM_ACCEPT.
+size_t shed_runs(std::vector<Run> &runs, const std::vector<Run> &accRuns, const RowBuffer &rows,
+                 size_t maxRuns, size_t memoryBudget, ShedPolicy policy, const std::vector<int> &distanceToAccept);
+
 struct Simulation {
     const NFA &nfa;
+    RowBuffer rows;                 // rows referenced by live runs, reclaimed after every step
     std::vector<Run> currentRuns;
-    std::vector<Run> accRuns;
+    std::vector<Run> accRuns;       // only filled when no sink is set
+
+    MatchSink sink;                 // if set, matches are emitted as soon as they are confirmed
+    size_t matchCount;
+    size_t shortestMatch;
+
+    size_t maxRuns;                 // 0 = unlimited
+    size_t memoryBudget;            // estimated bytes of live runs plus the rows they retain, 0 = unlimited
+    ShedPolicy shedPolicy;
+    size_t shedCount;
+    std::vector<int> distanceToAccept;
+    bool trace;                     // print every row and run while stepping
+
+    std::vector<std::vector<size_t>> groups;    // scratch: indices of currentRuns per state
+    BoundColumns bound;
+    std::vector<char> pass;
 
     Simulation(const NFA &nfa);
 
+    void emit(const Run &run);
     void epsilon_closure(std::vector<Run> &currentRuns);
     void print_run(const Run &run);
     void print_results(bool match); 
+    void evaluate_guards(const Row &row, std::vector<char> &passed);
+    bool step(const Row &row);
+    void push(const Row &row);
+    size_t memory() const;
+    void shed();
+    void reclaim();
     bool run(const std::vector<Row> &rows);
     void find_matches(Simulation &sim, std::vector<Row> &rows, bool after_match_skip_to_next_row);
     void reset();
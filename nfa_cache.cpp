@@ -0,0 +1,243 @@
+#include "nfa_cache.hpp"
+#include "binary.hpp"
+#include "lexer.hpp"
+#include "parser.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#else
+#include <process.h>
+#define getpid _getpid
+#endif
+
+static const char NFA_MAGIC[4] = {'N', 'F', 'A', 'B'};
+static const int NFA_VERSION = 1;
+
+void write_transition(std::ostream &out, const Transition &trans) {
+    out.put(static_cast<char>(trans.type));
+    write_svarint(out, trans.to);
+    out.put(trans.var);
+    write_svarint(out, trans.guard_id);
+}
+
+GuardEntry::GuardEntry(GuardFn guard, BatchGuardFn batch_guard, char batch_var)
+    : guard(guard), batch_guard(batch_guard), batch_var(batch_var) {}
+
+void bind_guard(Transition &trans, const GuardTable &guards) {
+    if (trans.guard_id < 0 || trans.guard_id >= (int)guards.size()) {
+        throw std::runtime_error("Unknown guard " + std::to_string(trans.guard_id));
+    }
+    const GuardEntry &entry = guards[trans.guard_id];
+    trans.guard = entry.guard;
+    trans.batch_guard = entry.batch_guard;
+    trans.batch_var = entry.batch_var;
+}
+
+Transition read_transition(std::istream &in, const GuardTable &guards) {
+    Transition trans;
+    int type = in.get();
+    if (type < static_cast<int>(TransitionType::NONE) || type > static_cast<int>(TransitionType::EPSILON)) {
+        throw std::runtime_error("Invalid transition type in compiled NFA");
+    }
+    trans.type = static_cast<TransitionType>(type);
+    trans.to = static_cast<int>(read_svarint(in));
+    trans.var = static_cast<char>(in.get());
+    trans.guard_id = static_cast<int>(read_svarint(in));
+
+    if (trans.guard_id >= 0) {
+        bind_guard(trans, guards);
+    }
+    return trans;
+}
+
+void write_nfa(std::ostream &out, const NFA &nfa) {
+    out.write(NFA_MAGIC, sizeof(NFA_MAGIC));
+    out.put(static_cast<char>(NFA_VERSION));
+    write_varint(out, nfa.start);
+    write_varint(out, nfa.accept);
+    write_varint(out, nfa.states.size());
+
+    for (const State &state : nfa.states) {
+        write_transition(out, state.out1);
+        write_transition(out, state.out2);
+    }
+}
+
+NFA read_nfa(std::istream &in, const GuardTable &guards) {
+    char magic[sizeof(NFA_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), NFA_MAGIC)) {
+        throw std::runtime_error("Not a compiled NFA");
+    }
+    if (in.get() != NFA_VERSION) {
+        throw std::runtime_error("Unsupported compiled NFA version");
+    }
+
+    // range-checked before narrowing, a large value would otherwise turn into a negative index
+    uint64_t start = read_varint(in);
+    uint64_t accept = read_varint(in);
+    uint64_t count = read_varint(in);
+    if (start >= count || accept >= count) {
+        throw std::runtime_error("Compiled NFA has an invalid start or accept state");
+    }
+
+    NFA nfa;
+    nfa.start = static_cast<int>(start);
+    nfa.accept = static_cast<int>(accept);
+
+    for (uint64_t i = 0; i < count; ++i) {
+        int id = nfa.new_state();
+        nfa.states[id].out1 = read_transition(in, guards);
+        nfa.states[id].out2 = read_transition(in, guards);
+    }
+
+    for (const State &state : nfa.states) {
+        for (const Transition *trans : {&state.out1, &state.out2}) {
+            if (trans->type != TransitionType::NONE && (trans->to < 0 || trans->to >= (int)count)) {
+                throw std::runtime_error("Compiled NFA has a transition to an invalid state");
+            }
+        }
+    }
+    return nfa;
+}
+
+void save_nfa(const std::string &path, const NFA &nfa) {
+    // write to a temporary file of our own first, so concurrent writers of the same key
+    // never share a file and loaders never see a partial one
+    std::random_device random;
+    std::string tmp = path + ".tmp." + std::to_string(getpid()) + "." + std::to_string(random());
+    {
+        std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            throw std::runtime_error("Cannot write " + tmp);
+        }
+        write_nfa(out, nfa);
+        if (!out.flush()) {
+            out.close();
+            std::remove(tmp.c_str());
+            throw std::runtime_error("Cannot write " + tmp);
+        }
+    }
+
+    std::error_code error;
+    std::filesystem::rename(tmp, path, error);
+    if (error) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Cannot replace " + path + ": " + error.message());
+    }
+}
+
+// read-only istream over a memory region
+struct MemoryBuf : std::streambuf {
+    MemoryBuf(const char *data, size_t size) {
+        char *begin = const_cast<char*>(data);
+        setg(begin, begin, begin + size);
+    }
+};
+
+#ifndef _WIN32
+NFA load_nfa(const std::string &path, const GuardTable &guards) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        throw std::runtime_error("Cannot read " + path);
+    }
+
+    void *data = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Cannot map " + path);
+    }
+
+    try {
+        MemoryBuf buf(static_cast<const char*>(data), st.st_size);
+        std::istream in(&buf);
+        NFA nfa = read_nfa(in, guards);
+        munmap(data, st.st_size);
+        return nfa;
+    } catch (...) {
+        munmap(data, st.st_size);
+        throw;
+    }
+}
+#else
+NFA load_nfa(const std::string &path, const GuardTable &guards) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    return read_nfa(in, guards);
+}
+#endif
+
+uint64_t pattern_key(const std::string &pattern, const std::string &guard_defs) {
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&hash](const std::string &value) {
+        for (unsigned char c : value) {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        hash ^= 0xff;   // separator, so "ab" + "c" and "a" + "bc" differ
+        hash *= 1099511628211ull;
+    };
+
+    mix(pattern);
+    mix(guard_defs);
+    return hash;
+}
+
+NFA compile_pattern(const std::string &pattern, const GuardIdFn &guard_id_for, const GuardTable &guards) {
+    Lexer lexer(pattern);
+    Parser parser(lexer);
+    Node* ast = parser.parse_pattern();
+    NFA nfa = build_from_AST(ast);
+    delete(ast);
+
+    for (State &state : nfa.states) {
+        if (state.out1.type == TransitionType::VAR) {
+            state.out1.guard_id = guard_id_for(state.out1.var);
+            bind_guard(state.out1, guards);
+        }
+    }
+    return nfa;
+}
+
+NFA compile_cached(const std::string &cache_dir, const std::string &pattern, const std::string &guard_defs,
+                   const GuardIdFn &guard_id_for, const GuardTable &guards) {
+    char name[32];
+    std::snprintf(name, sizeof(name), "%016llx.nfa", static_cast<unsigned long long>(pattern_key(pattern, guard_defs)));
+    std::string path = (std::filesystem::path(cache_dir) / name).string();
+
+    std::error_code error;
+    if (std::filesystem::exists(path, error)) {
+        try {
+            return load_nfa(path, guards);
+        } catch (const std::runtime_error &) {
+            // stale or corrupt entry, fall through and rebuild it
+        }
+    }
+
+    NFA nfa = compile_pattern(pattern, guard_id_for, guards);
+
+    // the cache is only an optimization, a read-only or full disk must not stop the caller
+    try {
+        std::filesystem::create_directories(cache_dir);
+        save_nfa(path, nfa);
+    } catch (const std::exception &) {
+    }
+    return nfa;
+}
@@ -0,0 +1,43 @@
+#ifndef NFA_CACHE_HPP
+#define NFA_CACHE_HPP
+
+#include "nfa.hpp"
+#include <iostream>
+#include <string>
+
+// a guard and, optionally, its batch version over the rows bound to batch_var
+struct GuardEntry {
+    GuardFn guard;
+    BatchGuardFn batch_guard;
+    char batch_var;
+
+    GuardEntry(GuardFn guard, BatchGuardFn batch_guard = BatchGuardFn(), char batch_var = 0);
+};
+
+using GuardTable = std::vector<GuardEntry>;
+using GuardIdFn = std::function<int(char var)>;
+
+/*
+Compiled NFA format:
+    file       ::= "NFAB" version:u8 start:varint accept:varint state_count:varint state*
+    state      ::= transition transition
+    transition ::= type:u8 to:svarint var:u8 guard_id:svarint
+
+Guards are stored by id only, the loader binds them (and their batch versions) from a guard table.
+*/
+void bind_guard(Transition &trans, const GuardTable &guards);
+
+void write_nfa(std::ostream &out, const NFA &nfa);
+NFA read_nfa(std::istream &in, const GuardTable &guards);
+
+void save_nfa(const std::string &path, const NFA &nfa);
+NFA load_nfa(const std::string &path, const GuardTable &guards);     // memory-maps the file
+
+// guard_defs should change whenever the meaning of a guard id changes
+uint64_t pattern_key(const std::string &pattern, const std::string &guard_defs);
+
+NFA compile_pattern(const std::string &pattern, const GuardIdFn &guard_id_for, const GuardTable &guards);
+NFA compile_cached(const std::string &cache_dir, const std::string &pattern, const std::string &guard_defs,
+                   const GuardIdFn &guard_id_for, const GuardTable &guards);
+
+#endif
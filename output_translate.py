@@ -1,4 +1,5 @@
 import re
+import sys
 from collections import defaultdict
 
 input_text = """
@@ -21,6 +22,53 @@ transitions = defaultdict(lambda: defaultdict(list))  # transitions[src][symbol]
 alphabet = set()
 states = set()
 
+# --- Read a compiled NFA (see nfa_cache.hpp) ---
+def read_varint(data, pos):
+    value, shift = 0, 0
+    while True:
+        b = data[pos]
+        pos += 1
+        value |= (b & 0x7f) << shift
+        if not b & 0x80:
+            return value, pos
+        shift += 7
+
+def read_svarint(data, pos):
+    value, pos = read_varint(data, pos)
+    return (value >> 1) ^ -(value & 1), pos
+
+def read_compiled(path):
+    global start_state
+    with open(path, "rb") as f:
+        data = f.read()
+    if data[:4] != b"NFAB" or data[4] != 1:
+        raise ValueError(f"{path} is not a compiled NFA (version 1)")
+
+    pos = 5
+    start_state, pos = read_varint(data, pos)
+    accept, pos = read_varint(data, pos)
+    count, pos = read_varint(data, pos)
+    states.update({start_state, accept})
+    accept_states.add(accept)
+
+    for src in range(count):
+        for _ in range(2):
+            kind = data[pos]
+            target, pos = read_svarint(data, pos + 1)
+            var = chr(data[pos])
+            _, pos = read_svarint(data, pos + 1)    # guard id
+            if kind == 0:   # NONE
+                continue
+            symbol = "$" if kind == 2 else var
+            states.update({src, target})
+            transitions[src][symbol].append(target)
+            if symbol != "$":
+                alphabet.add(symbol)
+
+if len(sys.argv) > 1:
+    read_compiled(sys.argv[1])
+    input_text = ""
+
 # --- Parse the text ---
 for line in input_text.splitlines():
     line = line.strip()
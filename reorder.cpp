@@ -0,0 +1,44 @@
+#include "reorder.hpp"
+
+bool LaterRow::operator()(const PendingRow &a, const PendingRow &b) const {
+    if (a.row.datetime != b.row.datetime) {
+        return a.row.datetime > b.row.datetime;
+    }
+    return a.arrival > b.arrival;
+}
+
+Reorderer::Reorderer(time_t lateness, RowSink out, size_t maxPending)
+    : lateness(lateness), maxPending(maxPending), watermark(0), started(false), arrivals(0), lateCount(0), out(out) {}
+
+// returns false if the row was dropped as late
+bool Reorderer::push(const Row &row) {
+    if (started && row.datetime < watermark) {
+        lateCount++;
+        return false;
+    }
+
+    pending.push({row, arrivals++});
+
+    if (!started || row.datetime - lateness > watermark) {
+        watermark = row.datetime - lateness;
+        started = true;
+    }
+
+    while (!pending.empty() && pending.top().row.datetime <= watermark) {
+        out(pending.top().row);
+        pending.pop();
+    }
+    while (maxPending > 0 && pending.size() > maxPending) {
+        watermark = pending.top().row.datetime;
+        out(pending.top().row);
+        pending.pop();
+    }
+    return true;
+}
+
+void Reorderer::flush() {
+    while (!pending.empty()) {
+        out(pending.top().row);
+        pending.pop();
+    }
+}
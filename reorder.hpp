@@ -0,0 +1,39 @@
+#ifndef REORDER_HPP
+#define REORDER_HPP
+
+#include "nfa.hpp"
+#include <queue>
+#include <functional>
+
+using RowSink = std::function<void(const Row&)>;
+
+struct PendingRow {
+    Row row;
+    uint64_t arrival;       // keeps rows with equal timestamps in arrival order
+};
+
+struct LaterRow {
+    bool operator()(const PendingRow &a, const PendingRow &b) const;
+};
+
+// bounded-lateness reorder stage: buffers rows in a min-heap on datetime and releases them
+// in order once the watermark (newest datetime seen minus lateness) has passed them.
+// Without maxPending the heap holds every row inside the lateness window, so its memory grows
+// with event rate times lateness. With it, the oldest rows are released early and the watermark
+// moves up to them, so rows behind those count as late.
+struct Reorderer {
+    time_t lateness;
+    size_t maxPending;      // 0 = unlimited
+    time_t watermark;
+    bool started;
+    uint64_t arrivals;
+    size_t lateCount;       // rows that arrived behind the watermark and were dropped
+    std::priority_queue<PendingRow, std::vector<PendingRow>, LaterRow> pending;
+    RowSink out;
+
+    Reorderer(time_t lateness, RowSink out, size_t maxPending = 0);
+    bool push(const Row &row);
+    void flush();
+};
+
+#endif
@@ -0,0 +1,212 @@
+#include "snapshot.hpp"
+#include "binary.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <stdexcept>
+
+static const char SNAPSHOT_MAGIC[4] = {'N', 'F', 'A', 'S'};
+static const int SNAPSHOT_VERSION = 3;
+
+void write_runs(std::ostream &out, const std::vector<Run> &runs) {
+    write_varint(out, runs.size());
+    for (const Run &run : runs) {
+        write_varint(out, run.state);
+        write_spans(out, run.bindings);
+    }
+}
+
+// rows from first on, plus everything else a record needs
+void write_record(std::ostream &out, char kind, const Simulation &sim, uint64_t first) {
+    const RowBuffer &rows = sim.rows;
+
+    out.put(kind);
+    write_varint(out, rows.head);
+    write_varint(out, first);
+    write_varint(out, rows.tail - first);
+    for (uint64_t seq = first; seq < rows.tail; ++seq) {
+        write_row(out, rows.at(seq));
+    }
+
+    write_varint(out, sim.matchCount);
+    write_varint(out, sim.shortestMatch);
+    write_varint(out, sim.shedCount);
+
+    write_runs(out, sim.currentRuns);
+    write_runs(out, sim.accRuns);
+}
+
+Checkpointer::Checkpointer(const std::string &path, const std::string &guardDefs, size_t baseEvery)
+    : path(path), guardDefs(guardDefs), baseEvery(baseEvery), deltas(0), written(0) {}
+
+// starts a new file with a base record, then swaps it in; assumes one checkpointer per path
+void Checkpointer::write_base(const Simulation &sim) {
+    std::string tmp = path + ".tmp";
+    {
+        std::ofstream base(tmp, std::ios::binary | std::ios::trunc);
+        if (!base) {
+            throw std::runtime_error("Cannot write " + tmp);
+        }
+        base.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        base.put(static_cast<char>(SNAPSHOT_VERSION));
+        write_u64(base, sim.nfa.fingerprint());
+        write_string(base, guardDefs);
+        write_record(base, 'B', sim, sim.rows.head);
+        if (!base.flush()) {
+            throw std::runtime_error("Cannot write " + tmp);
+        }
+    }
+
+    // std::rename does not replace an existing file on Windows, the filesystem one does
+    out.close();
+    std::error_code error;
+    std::filesystem::rename(tmp, path, error);
+    if (error) {
+        std::remove(tmp.c_str());
+        throw std::runtime_error("Cannot replace " + path + ": " + error.message());
+    }
+    out.open(path, std::ios::binary | std::ios::app);
+
+    deltas = 0;
+    written = sim.rows.tail;
+}
+
+void Checkpointer::checkpoint(const Simulation &sim) {
+    if (!out.is_open() || deltas >= baseEvery) {
+        write_base(sim);
+        return;
+    }
+
+    write_record(out, 'D', sim, std::max(written, sim.rows.head));
+    out.flush();
+    if (!out) {
+        throw std::runtime_error("Cannot write " + path);
+    }
+    deltas++;
+    written = sim.rows.tail;
+}
+
+// a record as read from the file, only applied once it was read completely
+struct Record {
+    char kind;
+    uint64_t head;
+    uint64_t first;
+    std::vector<Row> rows;
+    size_t matchCount;
+    size_t shortestMatch;
+    size_t shedCount;
+    std::vector<std::pair<int, std::vector<VarSpan>>> runs;
+    std::vector<std::pair<int, std::vector<VarSpan>>> accRuns;
+};
+
+void read_runs(std::istream &in, std::vector<std::pair<int, std::vector<VarSpan>>> &runs) {
+    uint64_t count = read_varint(in);
+    for (uint64_t i = 0; i < count; ++i) {
+        int state = static_cast<int>(read_varint(in));
+        runs.emplace_back(state, read_spans(in));
+    }
+}
+
+Record read_record(std::istream &in) {
+    Record record;
+    record.kind = static_cast<char>(in.get());
+    record.head = read_varint(in);
+    record.first = read_varint(in);
+
+    uint64_t count = read_varint(in);
+    for (uint64_t i = 0; i < count; ++i) {
+        record.rows.push_back(read_row(in));
+    }
+
+    record.matchCount = read_varint(in);
+    record.shortestMatch = read_varint(in);
+    record.shedCount = read_varint(in);
+
+    read_runs(in, record.runs);
+    read_runs(in, record.accRuns);
+    return record;
+}
+
+std::vector<Run> make_runs(const std::vector<std::pair<int, std::vector<VarSpan>>> &stored, const Simulation &sim) {
+    std::vector<Run> runs;
+    for (const auto &entry : stored) {
+        if (entry.first < 0 || entry.first >= (int)sim.nfa.states.size()) {
+            throw std::runtime_error("Snapshot references unknown state " + std::to_string(entry.first));
+        }
+        Run run(entry.first);
+        run.bindings = entry.second;
+        for (const VarSpan &span : run.bindings) {
+            for (uint64_t seq = span.first; seq <= span.last; ++seq) {
+                run.measures.add(span.var, sim.rows.at(seq));
+            }
+        }
+        runs.push_back(run);
+    }
+    return runs;
+}
+
+void apply(const Record &record, Simulation &sim) {
+    if (record.kind == 'B') {
+        sim.rows.reset(record.first);
+    } else if (record.first > sim.rows.tail) {
+        // every row in between was released before it was checkpointed
+        sim.rows.reset(record.first);
+    } else if (record.first < sim.rows.tail) {
+        throw std::runtime_error("Snapshot record overlaps the previous one");
+    }
+
+    for (const Row &row : record.rows) {
+        sim.rows.push(row);
+    }
+    sim.rows.release_before(record.head);
+
+    sim.matchCount = record.matchCount;
+    sim.shortestMatch = record.shortestMatch;
+    sim.shedCount = record.shedCount;
+
+    sim.currentRuns = make_runs(record.runs, sim);
+    sim.accRuns = make_runs(record.accRuns, sim);
+}
+
+void restore(std::istream &in, Simulation &sim, const std::string &guardDefs) {
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), SNAPSHOT_MAGIC)) {
+        throw std::runtime_error("Not a snapshot stream");
+    }
+    if (in.get() != SNAPSHOT_VERSION) {
+        throw std::runtime_error("Unsupported snapshot version");
+    }
+    if (read_u64(in) != sim.nfa.fingerprint()) {
+        throw std::runtime_error("Snapshot was taken from a different NFA");
+    }
+    if (read_string(in) != guardDefs) {
+        throw std::runtime_error("Snapshot was taken with different guards");
+    }
+    if (in.peek() != 'B') {
+        throw std::runtime_error("Snapshot does not start with a base record");
+    }
+
+    sim.reset();
+    bool restored = false;
+    while (in.peek() == 'B' || in.peek() == 'D') {
+        Record record;
+        try {
+            record = read_record(in);
+        } catch (const std::runtime_error &) {
+            if (!restored) {
+                throw std::runtime_error("Snapshot base record is incomplete");
+            }
+            break;      // torn last record, keep the state of the one before
+        }
+        apply(record, sim);
+        restored = true;
+    }
+}
+
+void restore(const std::string &path, Simulation &sim, const std::string &guardDefs) {
+    std::ifstream in(path, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Cannot open " + path);
+    }
+    restore(in, sim, guardDefs);
+}
@@ -0,0 +1,44 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include "nfa.hpp"
+#include <fstream>
+#include <iostream>
+#include <string>
+
+/*
+Snapshot file:
+    file     ::= header base delta*
+    header   ::= "NFAS" version:u8 fingerprint:u64 guard_defs:string
+    base     ::= 'B' record          every retained row, restore starts from here
+    delta    ::= 'D' record          only the rows pushed since the previous record
+    record   ::= head:varint first:varint row_count:varint row* counters run_count:varint run* acc_count:varint run*
+    counters ::= matchCount:varint shortestMatch:varint shedCount:varint
+    run      ::= state:varint spans
+
+Runs are written in full by every record, they are bounded by the live state. After baseEvery
+deltas the checkpointer writes a fresh base into a new file and renames it over the old one,
+so the file never holds more than one base and baseEvery deltas, independent of how long the
+stream has been running. Measures are not stored, restore recomputes them from the retained rows.
+The fingerprint only covers the NFA's structure and guard ids, guard_defs is the same string
+compile_cached keys on, so a snapshot taken before a guard changed meaning is refused.
+*/
+struct Checkpointer {
+    std::string path;
+    std::string guardDefs;
+    size_t baseEvery;
+    size_t deltas;          // delta records written since the last base
+    uint64_t written;       // rows below this sequence number are already in the file
+    std::ofstream out;
+
+    Checkpointer(const std::string &path, const std::string &guardDefs, size_t baseEvery = 64);
+    void checkpoint(const Simulation &sim);
+    void write_base(const Simulation &sim);
+};
+
+// restores the state of the last complete record, sim has to be built on the same NFA;
+// a torn record at the end (the writer died mid-checkpoint) is ignored
+void restore(std::istream &in, Simulation &sim, const std::string &guardDefs);
+void restore(const std::string &path, Simulation &sim, const std::string &guardDefs);
+
+#endif
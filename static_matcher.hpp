@@ -0,0 +1,339 @@
+#ifndef STATIC_MATCHER_HPP
+#define STATIC_MATCHER_HPP
+
+#include "nfa.hpp"
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+/*
+Compile-time specialized matcher for patterns that are fixed at build time.
+
+The pattern is turned into a Glushkov automaton during compilation: one state per variable
+occurrence (position) plus the start state 0, no epsilon transitions. Every transition's target
+position, and therefore its variable and guard type, is a constant, so the per-row work is a
+switch over the run's state and direct, inlinable guard calls.
+
+Guard types provide
+    static constexpr char var;
+    static bool check(const BindingView &bindings, const Row &row);
+variables without a guard type match every row.
+
+maxRuns, memoryBudget and shedPolicy work as in Simulation, but the limits are per engine and not
+interchangeable. A Simulation run waits in a Thompson state, and one partial match can occupy
+several of them (after R in RZ*BZ*M: one before Z, one before B), where it is a single run at a
+Glushkov position here. The same maxRuns therefore keeps more partial matches alive in this
+matcher, and the two engines can emit different matches once either of them sheds.
+*/
+
+namespace static_nfa {
+
+constexpr size_t length(const char *s) {
+    size_t n = 0;
+    while (s[n] != 0) {
+        n++;
+    }
+    return n;
+}
+
+template <size_t N>
+struct Glushkov {
+    int positions = 0;
+    char var[N + 1] = {};
+    uint64_t first = 0;
+    uint64_t last = 0;
+    bool nullable = false;
+    uint64_t follow[N + 1] = {};
+    int distance[N + 1] = {};       // rows still needed to reach an accepting position, for FARTHEST_FROM_ACCEPT
+};
+
+struct Fragment {
+    uint64_t first;
+    uint64_t last;
+    bool nullable;
+};
+
+// same grammar as Parser, see parser.cpp
+template <size_t N>
+struct Builder {
+    const char *input;
+    size_t pos;
+    Glushkov<N> g;
+
+    constexpr Builder(const char *input)
+        : input(input), pos(0), g() {}
+
+    constexpr char peek() const {
+        return pos < N ? input[pos] : 0;
+    }
+
+    constexpr void link(uint64_t from, uint64_t to) {
+        for (int p = 1; p <= g.positions; ++p) {
+            if ((from >> p) & 1) {
+                g.follow[p] |= to;
+            }
+        }
+    }
+
+    // row_pattern_nonempty ::= row_branch ('|' row_branch)*
+    constexpr Fragment parse_pattern() {
+        Fragment left = parse_branch();
+        while (peek() == '|') {
+            pos++;
+            Fragment right = parse_branch();
+            left = {left.first | right.first, left.last | right.last, left.nullable || right.nullable};
+        }
+        return left;
+    }
+
+    // row_branch ::= row_piece+
+    constexpr Fragment parse_branch() {
+        Fragment left = parse_piece();
+        while (peek() != 0 && peek() != '|' && peek() != ')') {
+            Fragment right = parse_piece();
+            link(left.last, right.first);
+            left = {left.first | (left.nullable ? right.first : 0),
+                    right.last | (right.nullable ? left.last : 0),
+                    left.nullable && right.nullable};
+        }
+        return left;
+    }
+
+    // row_piece ::= row_atom row_quantifier?
+    constexpr Fragment parse_piece() {
+        Fragment atom = parse_atom();
+        char c = peek();
+
+        if (c == '{' || c == '}') {
+            throw std::runtime_error("Quantifier syntax {m,n} is not supported.");
+        }
+        if (c == '*' || c == '+') {
+            pos++;
+            link(atom.last, atom.first);
+            atom.nullable = atom.nullable || c == '*';
+        } else if (c == '?') {
+            pos++;
+            atom.nullable = true;
+        }
+        return atom;
+    }
+
+    // row_atom ::= VAR | '(' row_pattern_nonempty ')'
+    constexpr Fragment parse_atom() {
+        char c = peek();
+        pos++;
+
+        if (c == '(') {
+            Fragment inner = parse_pattern();
+            if (peek() != ')') {
+                throw std::runtime_error("Expected ')'");
+            }
+            pos++;
+            return inner;
+        }
+        if (c == 0 || c == ')' || c == '*' || c == '+' || c == '?' || c == '|' || c == '{' || c == '}') {
+            throw std::runtime_error("Unexpected token in atom");
+        }
+        if (g.positions >= 63) {
+            throw std::runtime_error("Static patterns are limited to 63 variable occurrences");
+        }
+
+        int p = ++g.positions;
+        g.var[p] = c;
+        return {uint64_t(1) << p, uint64_t(1) << p, false};
+    }
+};
+
+template <size_t N>
+constexpr Glushkov<N> build(const char *pattern) {
+    Builder<N> builder(pattern);
+    Fragment whole = builder.parse_pattern();
+    if (builder.pos != N) {
+        throw std::runtime_error("Unexpected token after pattern");
+    }
+
+    builder.g.first = whole.first;
+    builder.g.last = whole.last;
+    builder.g.nullable = whole.nullable;
+
+    Glushkov<N> &g = builder.g;
+    const int unreachable = std::numeric_limits<int>::max();
+    for (int p = 0; p <= g.positions; ++p) {
+        g.distance[p] = p == 0 ? (g.nullable ? 0 : unreachable) : ((g.last >> p) & 1 ? 0 : unreachable);
+    }
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        for (int p = 0; p <= g.positions; ++p) {
+            uint64_t successors = p == 0 ? g.first : g.follow[p];
+            for (int q = 1; q <= g.positions; ++q) {
+                if (((successors >> q) & 1) && g.distance[q] != unreachable && g.distance[q] + 1 < g.distance[p]) {
+                    g.distance[p] = g.distance[q] + 1;
+                    changed = true;
+                }
+            }
+        }
+    }
+    return g;
+}
+
+struct AnyRow {
+    static bool check(const BindingView &, const Row &) {
+        return true;
+    }
+};
+
+template <char Var, typename... Guards>
+struct GuardFor {
+    using type = AnyRow;
+};
+
+template <char Var, typename Guard, typename... Guards>
+struct GuardFor<Var, Guard, Guards...> {
+    using type = typename std::conditional<Guard::var == Var, Guard, typename GuardFor<Var, Guards...>::type>::type;
+};
+
+}
+
+template <const char *Pattern, typename... Guards>
+struct StaticMatcher {
+    static constexpr size_t N = static_nfa::length(Pattern);
+    static constexpr static_nfa::Glushkov<N> G = static_nfa::build<N>(Pattern);
+    static constexpr size_t STATES = G.positions + 1;
+
+    RowBuffer rows;
+    std::vector<Run> currentRuns;
+    std::vector<Run> accRuns;       // only filled when no sink is set
+
+    MatchSink sink;
+    size_t matchCount;
+    size_t shortestMatch;
+
+    size_t maxRuns;                 // 0 = unlimited, per engine: see the note at the top
+    size_t memoryBudget;
+    ShedPolicy shedPolicy;
+    size_t shedCount;
+    std::vector<int> distanceToAccept;
+
+    StaticMatcher()
+        : rows(), matchCount(0), shortestMatch(0),
+          maxRuns(0), memoryBudget(0), shedPolicy(ShedPolicy::OLDEST_FIRST), shedCount(0),
+          distanceToAccept(G.distance, G.distance + STATES) {
+        seed();
+    }
+
+    void emit(const Run &run) {
+        size_t length = run.measures.count;
+        if (matchCount == 0 || length < shortestMatch) {
+            shortestMatch = length;
+        }
+        matchCount++;
+
+        if (sink) {
+            sink(make_match(run, rows));
+        } else {
+            accRuns.push_back(run);
+        }
+    }
+
+    void seed() {
+        Run start(0);
+        if (G.nullable) {
+            emit(start);
+        }
+        if (!run_exists(start, currentRuns)) {
+            currentRuns.push_back(start);
+        }
+    }
+
+    template <size_t From, size_t To>
+    void move(const Run &run, const Row &row, uint64_t seq, std::vector<Run> &nextRuns) {
+        constexpr uint64_t successors = From == 0 ? G.first : G.follow[From];
+
+        if constexpr (To != 0 && ((successors >> To) & 1)) {
+            using Guard = typename static_nfa::GuardFor<G.var[To], Guards...>::type;
+
+            if (Guard::check(BindingView(run.bindings, rows), row)) {
+                Run next = run;
+                next.state = To;
+                next.bind(G.var[To], seq, row);
+
+                if constexpr ((G.last >> To) & 1) {
+                    emit(next);
+                }
+                if constexpr (G.follow[To] != 0) {
+                    if (!run_exists(next, nextRuns)) {
+                        nextRuns.push_back(std::move(next));
+                    }
+                }
+            }
+        }
+    }
+
+    template <size_t From, size_t... To>
+    void advance(const Run &run, const Row &row, uint64_t seq, std::vector<Run> &nextRuns, std::index_sequence<To...>) {
+        (move<From, To>(run, row, seq, nextRuns), ...);
+    }
+
+    template <size_t... From>
+    void dispatch(const Run &run, const Row &row, uint64_t seq, std::vector<Run> &nextRuns, std::index_sequence<From...>) {
+        ((run.state == (int)From
+            ? (advance<From>(run, row, seq, nextRuns, std::make_index_sequence<STATES>()), true)
+            : false) || ...);
+    }
+
+    bool step(const Row &row) {
+        uint64_t seq = rows.push(row);
+        const Row &stored = rows.at(seq);
+
+        std::vector<Run> nextRuns;
+        for (const Run &run : currentRuns) {
+            dispatch(run, stored, seq, nextRuns, std::make_index_sequence<STATES>());
+        }
+        currentRuns = std::move(nextRuns);
+        shedCount += shed_runs(currentRuns, accRuns, rows, maxRuns, memoryBudget, shedPolicy, distanceToAccept);
+        reclaim();
+
+        return !currentRuns.empty();
+    }
+
+    // streaming entry point, same semantics as Simulation::push
+    void push(const Row &row) {
+        seed();
+        step(row);
+    }
+
+    void reclaim() {
+        uint64_t oldest = rows.tail;
+        for (const Run &run : currentRuns) {
+            oldest = std::min(oldest, run.start_seq(rows.tail));
+        }
+        for (const Run &run : accRuns) {
+            oldest = std::min(oldest, run.start_seq(rows.tail));
+        }
+        rows.release_before(oldest);
+    }
+
+    bool run(const std::vector<Row> &rows) {
+        for (const Row &row : rows) {
+            if (!step(row)) {
+                break;
+            }
+        }
+        return matchCount > 0;
+    }
+
+    void reset() {
+        currentRuns.clear();
+        accRuns.clear();
+        rows.release_before(rows.tail);
+        matchCount = 0;
+        shortestMatch = 0;
+        shedCount = 0;
+        seed();
+    }
+};
+
+#endif
@@ -0,0 +1,165 @@
+// Batch guards against the per-run guards they replace.
+// g++ -std=c++17 -o batch_guards tests/batch_guards.cpp nfa.cpp parser.cpp lexer.cpp && ./batch_guards
+
+#include "check.hpp"
+#include <cmath>
+#include <sstream>
+
+// A starts runs without R, so B and M are also evaluated with their batch variable unbound
+const std::string PATTERN = "(R|A)Z*BZ*M";
+
+bool near(const Row &row, double lat, double lon) {
+    return std::abs(row.lat - lat) <= 0.02 && std::abs(row.lon - lon) <= 0.05;
+}
+
+bool soon(const Row &row, time_t datetime) {
+    return std::abs(row.datetime - datetime) <= 30 * 60;
+}
+
+GuardFn guard_for(char var) {
+    switch (var) {
+        case 'R': return [](const BindingView &, const Row &row) { return row.primary_type == "ROBBERY"; };
+        case 'A': return [](const BindingView &, const Row &row) { return row.primary_type == "ASSAULT"; };
+        case 'B': return [](const BindingView &bindings, const Row &B) {
+            const Row *R = bindings.first('R');
+            return B.primary_type == "BATTERY" && R && near(B, R->lat, R->lon);
+        };
+        case 'M': return [](const BindingView &bindings, const Row &M) {
+            const Row *R = bindings.first('R');
+            return M.primary_type == "MOTOR VEHICLE THEFT" && R && near(M, R->lat, R->lon) && soon(M, R->datetime);
+        };
+        default:  return [](const BindingView &, const Row &) { return true; };
+    }
+}
+
+int batch_calls = 0;
+
+// an unbound R arrives as NaN coordinates, which have to fail like the missing row above
+BatchGuardFn batch_B = [] (const Row &B, const BoundColumns &R, std::vector<char> &pass) {
+    batch_calls++;
+    for (size_t i = 0; i < R.size(); ++i) {
+        pass[i] = B.primary_type == "BATTERY" && near(B, R.lat[i], R.lon[i]);
+    }
+};
+
+BatchGuardFn batch_M = [] (const Row &M, const BoundColumns &R, std::vector<char> &pass) {
+    batch_calls++;
+    for (size_t i = 0; i < R.size(); ++i) {
+        pass[i] = M.primary_type == "MOTOR VEHICLE THEFT" && near(M, R.lat[i], R.lon[i]) && soon(M, R.datetime[i]);
+    }
+};
+
+NFA compile_guarded(bool batched) {
+    NFA nfa = parse(PATTERN);
+    for (State &state : nfa.states) {
+        Transition &trans = state.out1;
+        if (trans.type != TransitionType::VAR) {
+            continue;
+        }
+        trans.guard = guard_for(trans.var);
+        if (batched && (trans.var == 'B' || trans.var == 'M')) {
+            trans.batch_guard = trans.var == 'B' ? batch_B : batch_M;
+            trans.batch_var = 'R';
+        }
+    }
+    return nfa;
+}
+
+// deterministic mix of crime types close enough together that B and M often pass
+std::vector<Row> make_rows(int count) {
+    const char *types[] = {"ROBBERY", "ASSAULT", "BATTERY", "MOTOR VEHICLE THEFT", "THEFT"};
+    std::vector<Row> rows;
+    uint32_t state = 7;
+    auto next = [&state]() {
+        state = state * 1103515245u + 12345u;
+        return (state >> 8) % 100;
+    };
+    for (int i = 0; i < count; ++i) {
+        const char *type = types[next() % 5];
+        float lat = 41.8f + next() * 0.0005f;
+        float lon = -87.7f + next() * 0.001f;
+        rows.push_back({i, "", 1514870000 + i * 300, type, lat, lon});
+    }
+    return rows;
+}
+
+using Keys = std::vector<std::vector<std::pair<uint64_t, uint64_t>>>;
+
+// the trace lists every run with its accepted or rejected transition, the sink every match
+void run(const NFA &nfa, const std::vector<Row> &rows, std::string &trace, Keys &matches) {
+    std::ostringstream out;
+    std::streambuf *console = std::cout.rdbuf(out.rdbuf());
+
+    Simulation sim(nfa);
+    sim.sink = [&matches](const Match &match) {
+        matches.emplace_back();
+        for (const MatchSpan &span : match.spans) {
+            matches.back().emplace_back(span.first, span.last);
+        }
+    };
+    for (const Row &row : rows) {
+        sim.push(row);
+    }
+
+    std::cout.rdbuf(console);
+    trace = out.str();
+}
+
+void check_same(const std::vector<Row> &rows) {
+    std::string per_run_trace;
+    std::string batch_trace;
+    Keys per_run_matches;
+    Keys batch_matches;
+
+    run(compile_guarded(false), rows, per_run_trace, per_run_matches);
+    CHECK(batch_calls == 0);
+    run(compile_guarded(true), rows, batch_trace, batch_matches);
+    CHECK(batch_calls > 0);
+
+    CHECK(per_run_trace.find(" accepted") != std::string::npos);
+    CHECK(per_run_trace.find(" rejected") != std::string::npos);
+    CHECK(per_run_trace == batch_trace);
+    CHECK(!per_run_matches.empty());
+    CHECK(per_run_matches == batch_matches);
+}
+
+// runs started by A reach B and M with R unbound, and must never pass there
+void check_unbound() {
+    NFA nfa = compile_guarded(true);
+    std::vector<Row> rows = {
+        {0, "", 1514870000, "ASSAULT", 41.8f, -87.7f},
+        {1, "", 1514870060, "BATTERY", 41.8f, -87.7f},
+        {2, "", 1514870120, "MOTOR VEHICLE THEFT", 41.8f, -87.7f}
+    };
+
+    std::ostringstream out;
+    std::streambuf *console = std::cout.rdbuf(out.rdbuf());
+    size_t matches = 0;
+    Simulation sim(nfa);
+    sim.sink = [&matches](const Match &) { matches++; };
+    for (const Row &row : rows) {
+        sim.step(row);
+    }
+    std::cout.rdbuf(console);
+
+    std::istringstream trace(out.str());
+    std::string line;
+    int b_checks = 0;
+    while (std::getline(trace, line)) {
+        if (line.compare(0, 5, "B -> ") == 0) {
+            CHECK(line.find(" rejected") != std::string::npos);
+            b_checks++;
+        }
+    }
+    CHECK(b_checks > 0);
+    CHECK(matches == 0);
+}
+
+int main() {
+    std::vector<Row> rows = make_rows(200);
+    check_same(rows);
+    check_unbound();
+
+    std::cout << "batch_guards: ok\n";
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,44 @@
+// Shared by the tests in this directory.
+
+#ifndef TESTS_CHECK_HPP
+#define TESTS_CHECK_HPP
+
+#include "../lexer.hpp"
+#include "../nfa.hpp"
+#include "../parser.hpp"
+#include <cstdlib>
+#include <iostream>
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": check failed: " #cond "\n"; \
+            std::exit(1); \
+        } \
+    } while (0)
+
+// the pattern's NFA without guards
+inline NFA parse(const std::string &pattern) {
+    Lexer lexer(pattern);
+    Parser parser(lexer);
+    Node* ast = parser.parse_pattern();
+    NFA nfa = build_from_AST(ast);
+    delete(ast);
+    return nfa;
+}
+
+// a variable matches rows whose primary_type starts with it, Z matches every row
+inline NFA compile(const std::string &pattern) {
+    NFA nfa = parse(pattern);
+    for (State &state : nfa.states) {
+        if (state.out1.type == TransitionType::VAR) {
+            char var = state.out1.var;
+            state.out1.guard = [var](const BindingView &, const Row &row) {
+                return var == 'Z' || row.primary_type[0] == var;
+            };
+        }
+    }
+    return nfa;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,189 @@
+// Compiled NFA format, the mmap loader and the on-disk cache.
+// g++ -std=c++17 -o nfa_cache tests/nfa_cache.cpp nfa_cache.cpp binary.cpp nfa.cpp parser.cpp lexer.cpp && ./nfa_cache
+
+#include "check.hpp"
+#include "../binary.hpp"
+#include "../nfa_cache.hpp"
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+const std::string PATTERN = "RZ*(B|M)+Z?M";
+const std::string GUARD_DEFS = "Z:any,R,B,M:primary_type starts with the variable,B batched over R";
+
+GuardFn starts_with(char var) {
+    return [var](const BindingView &, const Row &row) {
+        return row.primary_type[0] == var;
+    };
+}
+
+BatchGuardFn batch_B = [] (const Row &row, const BoundColumns &R, std::vector<char> &pass) {
+    for (size_t i = 0; i < R.size(); ++i) {
+        pass[i] = row.primary_type[0] == 'B';
+    }
+};
+
+GuardFn wildcard = [](const BindingView &, const Row &) {
+    return true;
+};
+
+GuardTable guards = {
+    wildcard,
+    starts_with('R'),
+    {starts_with('B'), batch_B, 'R'},
+    starts_with('M')
+};
+
+int compiles = 0;      // guard_id_for is only called when the pattern is compiled, not when it is loaded
+
+int guard_id_for(char var) {
+    compiles++;
+    switch (var) {
+        case 'R': return 1;
+        case 'B': return 2;
+        case 'M': return 3;
+        default:  return 0;
+    }
+}
+
+// same structure and guard ids, and every guard bound from the same table entry
+bool same_nfa(const NFA &a, const NFA &b) {
+    if (a.start != b.start || a.accept != b.accept || a.states.size() != b.states.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.states.size(); ++i) {
+        const Transition *x[] = {&a.states[i].out1, &a.states[i].out2};
+        const Transition *y[] = {&b.states[i].out1, &b.states[i].out2};
+        for (int k = 0; k < 2; ++k) {
+            if (x[k]->type != y[k]->type || x[k]->to != y[k]->to || x[k]->var != y[k]->var || x[k]->guard_id != y[k]->guard_id) {
+                return false;
+            }
+            if (bool(x[k]->guard) != bool(y[k]->guard) || bool(x[k]->batch_guard) != bool(y[k]->batch_guard)
+                    || x[k]->batch_var != y[k]->batch_var) {
+                return false;
+            }
+        }
+    }
+    return a.fingerprint() == b.fingerprint();
+}
+
+// the loaded guards behave like the table's, not just exist
+void check_bound_guards(const NFA &nfa) {
+    std::vector<VarSpan> spans;
+    RowBuffer rows;
+    for (const State &state : nfa.states) {
+        const Transition &trans = state.out1;
+        if (trans.type != TransitionType::VAR) {
+            continue;
+        }
+        CHECK(trans.guard);
+        for (const char *type : {"ROBBERY", "BATTERY", "MOTOR VEHICLE THEFT", "ASSAULT"}) {
+            Row row = {0, "", 0, type, 41.0f, -87.0f};
+            bool expected = trans.var == 'Z' || type[0] == trans.var;
+            CHECK(trans.guard(BindingView(spans, rows), row) == expected);
+        }
+        CHECK(bool(trans.batch_guard) == (trans.var == 'B'));
+        CHECK(trans.batch_var == (trans.var == 'B' ? 'R' : 0));
+    }
+}
+
+void check_format(const NFA &nfa) {
+    std::stringstream bytes;
+    write_nfa(bytes, nfa);
+    NFA read = read_nfa(bytes, guards);
+    CHECK(same_nfa(nfa, read));
+    check_bound_guards(read);
+}
+
+bool rejected(const std::string &bytes) {
+    std::istringstream in(bytes);
+    try {
+        read_nfa(in, guards);
+    } catch (const std::runtime_error &) {
+        return true;
+    }
+    return false;
+}
+
+// a start or accept state that does not fit an int must not wrap around to a negative index
+void check_invalid(const NFA &nfa) {
+    std::ostringstream out;
+    write_nfa(out, nfa);
+    std::string valid = out.str();
+    CHECK(nfa.start < 128 && nfa.accept < 128);      // both are single-byte varints at offsets 5 and 6
+
+    std::ostringstream huge;
+    write_varint(huge, 0xffffffffull);
+    std::string bytes = valid.substr(0, 5) + huge.str() + valid.substr(6);
+    CHECK(rejected(bytes));
+    bytes = valid.substr(0, 6) + huge.str() + valid.substr(7);
+    CHECK(rejected(bytes));
+
+    CHECK(rejected(valid.substr(0, valid.size() - 2)));
+    CHECK(rejected("NFAB"));
+    CHECK(!rejected(valid));
+}
+
+void check_cache(const NFA &expected) {
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "nfa_cache_test";
+    std::filesystem::remove_all(dir);
+
+    // miss: compiled and written
+    compiles = 0;
+    NFA first = compile_cached(dir.string(), PATTERN, GUARD_DEFS, guard_id_for, guards);
+    CHECK(compiles > 0);
+    CHECK(same_nfa(expected, first));
+    std::filesystem::path entry;
+    for (const auto &file : std::filesystem::directory_iterator(dir)) {
+        entry = file.path();
+    }
+    CHECK(entry.extension() == ".nfa");
+
+    // hit: loaded through the mmap path without compiling
+    compiles = 0;
+    NFA second = compile_cached(dir.string(), PATTERN, GUARD_DEFS, guard_id_for, guards);
+    CHECK(compiles == 0);
+    CHECK(same_nfa(expected, second));
+    check_bound_guards(second);
+    CHECK(same_nfa(expected, load_nfa(entry.string(), guards)));
+
+    // different guard definitions are a different entry
+    compiles = 0;
+    compile_cached(dir.string(), PATTERN, GUARD_DEFS + ",changed", guard_id_for, guards);
+    CHECK(compiles > 0);
+
+    // truncated and corrupt entries are rebuilt and rewritten
+    uintmax_t size = std::filesystem::file_size(entry);
+    std::filesystem::resize_file(entry, size / 2);
+    compiles = 0;
+    CHECK(same_nfa(expected, compile_cached(dir.string(), PATTERN, GUARD_DEFS, guard_id_for, guards)));
+    CHECK(compiles > 0);
+    CHECK(std::filesystem::file_size(entry) == size);
+
+    {
+        std::fstream file(entry, std::ios::binary | std::ios::in | std::ios::out);
+        file.seekp(5);
+        std::ostringstream huge;
+        write_varint(huge, 0xffffffffull);
+        file << huge.str();
+    }
+    compiles = 0;
+    CHECK(same_nfa(expected, compile_cached(dir.string(), PATTERN, GUARD_DEFS, guard_id_for, guards)));
+    CHECK(compiles > 0);
+    compiles = 0;
+    compile_cached(dir.string(), PATTERN, GUARD_DEFS, guard_id_for, guards);
+    CHECK(compiles == 0);
+
+    std::filesystem::remove_all(dir);
+}
+
+int main() {
+    NFA nfa = compile_pattern(PATTERN, guard_id_for, guards);
+
+    check_format(nfa);
+    check_invalid(nfa);
+    check_cache(nfa);
+
+    std::cout << "nfa_cache: ok\n";
+    return 0;
+}
\ No newline at end of file
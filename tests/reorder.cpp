@@ -0,0 +1,95 @@
+// Bounded-lateness reordering.
+// g++ -std=c++17 -o reorder tests/reorder.cpp reorder.cpp nfa.cpp parser.cpp lexer.cpp && ./reorder
+
+#include "check.hpp"
+#include "../reorder.hpp"
+
+Row row_at(int id, time_t datetime) {
+    return {id, "", datetime, "ASSAULT", 41.0f, -87.0f};
+}
+
+// rows come out sorted by datetime, rows with the same datetime in the order they arrived
+void check_order() {
+    std::vector<Row> released;
+    Reorderer reorderer(10, [&released](const Row &row) { released.push_back(row); });
+
+    time_t times[] = {100, 95, 100, 92, 105, 100, 111, 103, 120};
+    for (int i = 0; i < 9; ++i) {
+        CHECK(reorderer.push(row_at(i, times[i])));
+    }
+    reorderer.flush();
+
+    std::vector<int> ids;
+    for (const Row &row : released) {
+        ids.push_back(row.id);
+    }
+    CHECK((ids == std::vector<int>{3, 1, 0, 2, 5, 7, 4, 6, 8}));
+    CHECK(reorderer.lateCount == 0);
+}
+
+// the watermark is newest minus lateness: a row exactly on it is kept, one below is dropped
+void check_watermark() {
+    std::vector<Row> released;
+    Reorderer reorderer(10, [&released](const Row &row) { released.push_back(row); });
+
+    CHECK(reorderer.push(row_at(0, 100)));
+    CHECK(reorderer.push(row_at(1, 90)));
+    CHECK(!reorderer.push(row_at(2, 89)));
+    CHECK(reorderer.lateCount == 1);
+
+    CHECK(reorderer.push(row_at(3, 130)));
+    CHECK(!reorderer.push(row_at(4, 110)));
+    CHECK(reorderer.push(row_at(5, 120)));
+    CHECK(reorderer.lateCount == 2);
+
+    reorderer.flush();
+    CHECK(released.size() == 4);
+}
+
+// flush releases everything still buffered, in order
+void check_flush() {
+    std::vector<Row> released;
+    Reorderer reorderer(1000, [&released](const Row &row) { released.push_back(row); });
+
+    for (int i = 0; i < 50; ++i) {
+        reorderer.push(row_at(i, 500 - i * 3 % 17));
+    }
+    CHECK(released.empty());
+    CHECK(reorderer.pending.size() == 50);
+
+    reorderer.flush();
+    CHECK(reorderer.pending.empty());
+    CHECK(released.size() == 50);
+    for (size_t i = 1; i < released.size(); ++i) {
+        CHECK(released[i - 1].datetime <= released[i].datetime);
+    }
+}
+
+// with maxPending the heap stays bounded, rows behind an early released one are late
+void check_max_pending() {
+    std::vector<Row> released;
+    Reorderer reorderer(1000000, [&released](const Row &row) { released.push_back(row); }, 8);
+
+    for (int i = 0; i < 100; ++i) {
+        reorderer.push(row_at(i, i));
+        CHECK(reorderer.pending.size() <= 8);
+    }
+    CHECK(released.size() == 92);
+    CHECK(!reorderer.push(row_at(100, 50)));
+    CHECK(reorderer.lateCount == 1);
+
+    reorderer.flush();
+    for (size_t i = 1; i < released.size(); ++i) {
+        CHECK(released[i - 1].datetime <= released[i].datetime);
+    }
+}
+
+int main() {
+    check_order();
+    check_watermark();
+    check_flush();
+    check_max_pending();
+
+    std::cout << "reorder: ok\n";
+    return 0;
+}
\ No newline at end of file
@@ -0,0 +1,169 @@
+// Round-trip checks for the binary formats.
+// g++ -std=c++17 -o roundtrip tests/roundtrip.cpp binary.cpp snapshot.cpp nfa.cpp parser.cpp lexer.cpp && ./roundtrip
+
+#include "check.hpp"
+#include "../binary.hpp"
+#include "../snapshot.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <sstream>
+
+const std::string GUARD_DEFS = "Z:any,other:primary_type starts with the variable";
+
+std::vector<Row> make_rows(int count) {
+    const char *types[] = {"R", "Z", "B", "R", "Z", "M", "B", "Z", "M", "R", "M"};
+    std::vector<Row> rows;
+    for (int i = 0; i < count; ++i) {
+        rows.push_back({1000 + i, "", i * 60, types[(i * 7) % 11], 41.0f + 0.01f * i, -87.0f - 0.01f * i});
+    }
+    return rows;
+}
+
+bool same_match(const Match &a, const Match &b) {
+    if (a.spans.size() != b.spans.size() || a.measures.vars.size() != b.measures.vars.size()) {
+        return false;
+    }
+    for (size_t i = 0; i < a.spans.size(); ++i) {
+        const MatchSpan &x = a.spans[i];
+        const MatchSpan &y = b.spans[i];
+        if (x.var != y.var || x.first != y.first || x.last != y.last || x.first_id != y.first_id || x.last_id != y.last_id) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.measures.vars.size(); ++i) {
+        const VarMeasures &x = a.measures.vars[i];
+        const VarMeasures &y = b.measures.vars[i];
+        if (x.var != y.var || x.count != y.count || x.first != y.first || x.last != y.last ||
+            x.lat.min != y.lat.min || x.lat.max != y.lat.max || x.lat.sum != y.lat.sum ||
+            x.lon.min != y.lon.min || x.lon.max != y.lon.max || x.lon.sum != y.lon.sum) {
+            return false;
+        }
+    }
+    return a.measures.count == b.measures.count && a.measures.first == b.measures.first && a.measures.last == b.measures.last;
+}
+
+void check_match_stream(const NFA &nfa, const std::vector<Row> &rows) {
+    std::vector<Match> emitted;
+    std::stringstream stream;
+    MatchWriter writer(stream);
+
+    Simulation sim(nfa);
+    sim.sink = [&](const Match &match) {
+        emitted.push_back(match);
+        writer(match);
+    };
+    for (const Row &row : rows) {
+        sim.push(row);
+    }
+
+    std::vector<Match> decoded = read_matches(stream);
+    CHECK(!emitted.empty());
+    CHECK(decoded.size() == emitted.size());
+    for (size_t i = 0; i < emitted.size(); ++i) {
+        CHECK(same_match(emitted[i], decoded[i]));
+    }
+}
+
+bool same_state(const Simulation &a, const Simulation &b) {
+    if (a.rows.head != b.rows.head || a.rows.tail != b.rows.tail || a.currentRuns.size() != b.currentRuns.size()) {
+        return false;
+    }
+    for (uint64_t seq = a.rows.head; seq < a.rows.tail; ++seq) {
+        if (a.rows.at(seq).id != b.rows.at(seq).id || a.rows.at(seq).primary_type != b.rows.at(seq).primary_type) {
+            return false;
+        }
+    }
+    for (size_t i = 0; i < a.currentRuns.size(); ++i) {
+        const Run &x = a.currentRuns[i];
+        const Run &y = b.currentRuns[i];
+        if (x.state != y.state || x.bindings.size() != y.bindings.size() || x.measures.count != y.measures.count) {
+            return false;
+        }
+        for (size_t k = 0; k < x.bindings.size(); ++k) {
+            if (x.bindings[k].var != y.bindings[k].var || x.bindings[k].first != y.bindings[k].first || x.bindings[k].last != y.bindings[k].last) {
+                return false;
+            }
+        }
+    }
+    return a.matchCount == b.matchCount && a.shortestMatch == b.shortestMatch && a.shedCount == b.shedCount;
+}
+
+// checkpoints a long stream, restores mid-way and checks the restored engine continues identically
+void check_snapshot(const NFA &nfa, const std::vector<Row> &rows) {
+    std::string path = (std::filesystem::temp_directory_path() / "nfa_roundtrip.snapshot").string();
+    std::remove(path.c_str());
+
+    Simulation live(nfa);
+    live.sink = [](const Match &) {};
+    live.maxRuns = 40;
+
+    Checkpointer checkpointer(path, GUARD_DEFS, 16);
+    size_t half = rows.size() / 2;
+    uintmax_t largest = 0;
+    for (size_t i = 0; i < half; ++i) {
+        live.push(rows[i]);
+        if (i % 7 == 6) {
+            checkpointer.checkpoint(live);
+            largest = std::max(largest, std::filesystem::file_size(path));
+        }
+    }
+    checkpointer.checkpoint(live);
+
+    // the file holds one base and at most baseEvery deltas, however long the stream was
+    CHECK(largest < 64 * 1024);
+
+    Simulation restored(nfa);
+    restore(path, restored, GUARD_DEFS);
+    restored.maxRuns = 40;
+    CHECK(same_state(live, restored));
+
+    size_t live_matches = 0;
+    size_t restored_matches = 0;
+    live.sink = [&](const Match &) { live_matches++; };
+    restored.sink = [&](const Match &) { restored_matches++; };
+    for (size_t i = half; i < rows.size(); ++i) {
+        live.push(rows[i]);
+        restored.push(rows[i]);
+    }
+    CHECK(live_matches > 0);
+    CHECK(live_matches == restored_matches);
+    CHECK(same_state(live, restored));
+
+    // a torn last record is ignored, restore falls back to the record before it
+    Simulation before(nfa);
+    restore(path, before, GUARD_DEFS);
+    checkpointer.checkpoint(live);
+    CHECK(checkpointer.deltas > 0);
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 3);
+    Simulation torn(nfa);
+    restore(path, torn, GUARD_DEFS);
+    CHECK(same_state(before, torn));
+
+    // same NFA, but the guards changed meaning since the snapshot was taken
+    Simulation regarded(nfa);
+    bool refused = false;
+    try {
+        restore(path, regarded, GUARD_DEFS + ",changed");
+    } catch (const std::runtime_error &) {
+        refused = true;
+    }
+    CHECK(refused);
+
+    std::remove(path.c_str());
+}
+
+int main() {
+    // Simulation traces every row, the checks only look at what it emits
+    std::ostringstream trace;
+    std::streambuf *console = std::cout.rdbuf(trace.rdbuf());
+
+    NFA nfa = compile("RZ*BZ*M");
+    std::vector<Row> rows = make_rows(60);
+
+    check_match_stream(nfa, rows);
+    check_snapshot(nfa, make_rows(20000));
+
+    std::cout.rdbuf(console);
+    std::cout << "roundtrip: ok\n";
+    return 0;
+}
@@ -0,0 +1,92 @@
+// Live-run cap and memory budget under an adversarial stream.
+// g++ -std=c++17 -o shedding tests/shedding.cpp nfa.cpp parser.cpp lexer.cpp && ./shedding
+
+#include "check.hpp"
+#include <sstream>
+
+// bursts of ROBBERY rows followed by long stretches that only Z* accepts, so runs never die
+std::vector<Row> adversarial_rows(int count) {
+    std::vector<Row> rows;
+    for (int i = 0; i < count; ++i) {
+        const char *type = (i % 200) < 50 ? "ROBBERY" : (i % 200) == 150 ? "BATTERY" : "ASSAULT";
+        rows.push_back({i, "1/2/2018 5:30", i * 60, type, 41.0f, -87.0f});
+    }
+    return rows;
+}
+
+void check_limits(const NFA &nfa, const std::vector<Row> &rows, ShedPolicy policy, size_t max_runs) {
+    Simulation sim(nfa);
+    sim.sink = [](const Match &) {};
+    sim.maxRuns = max_runs;
+    sim.memoryBudget = 256 * 1024;
+    sim.shedPolicy = policy;
+
+    for (const Row &row : rows) {
+        sim.push(row);
+        CHECK(max_runs == 0 || sim.currentRuns.size() <= max_runs);
+        CHECK(sim.memory() <= sim.memoryBudget);
+    }
+    CHECK(sim.shedCount > 0);
+    CHECK(sim.rows.ring.size() <= 4 * RowBuffer::MIN_CAPACITY + 4 * sim.rows.size());
+}
+
+// memory_from has to agree with summing the retained rows, across growing and shrinking the ring
+void check_retained_memory(const std::vector<Row> &rows) {
+    RowBuffer buffer;
+    for (const Row &row : rows) {
+        buffer.push(row);
+        if (row.id % 3 == 0) {
+            buffer.release_before(buffer.tail - buffer.size() / 2);
+        }
+
+        size_t expected = 0;
+        for (uint64_t seq = buffer.tail; seq-- > buffer.head; ) {
+            expected += row_memory(buffer.at(seq));
+            CHECK(buffer.memory_from(seq) == expected);
+        }
+        CHECK(buffer.memory_from(0) == buffer.memory());
+        CHECK(buffer.memory_from(buffer.tail) == 0);
+    }
+}
+
+void check_no_shedding_below_limits(const NFA &nfa, const std::vector<Row> &rows) {
+    size_t unlimited = 0;
+    size_t limited = 0;
+
+    Simulation a(nfa);
+    a.sink = [&](const Match &) { unlimited++; };
+    Simulation b(nfa);
+    b.sink = [&](const Match &) { limited++; };
+    b.maxRuns = 1000000;
+    b.memoryBudget = 1024 * 1024 * 1024;
+
+    for (const Row &row : rows) {
+        a.push(row);
+        b.push(row);
+    }
+    CHECK(b.shedCount == 0);
+    CHECK(limited == unlimited);
+}
+
+int main() {
+    std::ostringstream trace;
+    std::streambuf *console = std::cout.rdbuf(trace.rdbuf());
+
+    NFA nfa = compile("RZ*BZ*M");
+    std::vector<Row> rows = adversarial_rows(5000);
+
+    check_limits(nfa, rows, ShedPolicy::OLDEST_FIRST, 64);
+    check_limits(nfa, rows, ShedPolicy::LOWEST_PROGRESS_FIRST, 64);
+    check_limits(nfa, rows, ShedPolicy::FARTHEST_FROM_ACCEPT, 64);
+
+    // memory budget alone, on a shorter stream since it allows a few thousand runs
+    std::vector<Row> burst = adversarial_rows(1000);
+    check_limits(nfa, burst, ShedPolicy::OLDEST_FIRST, 0);
+    check_limits(nfa, burst, ShedPolicy::LOWEST_PROGRESS_FIRST, 0);
+    check_no_shedding_below_limits(nfa, adversarial_rows(300));
+    check_retained_memory(adversarial_rows(300));
+
+    std::cout.rdbuf(console);
+    std::cout << "shedding: ok\n";
+    return 0;
+}
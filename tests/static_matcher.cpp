@@ -0,0 +1,175 @@
+// StaticMatcher against Simulation: same matches, the run limits hold, and the time both take.
+// The Simulation trace is switched off so only the matching itself is timed.
+// g++ -std=c++17 -O2 -o static_matcher tests/static_matcher.cpp nfa.cpp parser.cpp lexer.cpp && ./static_matcher
+
+#include "check.hpp"
+#include "../static_matcher.hpp"
+#include <algorithm>
+#include <chrono>
+#include <tuple>
+
+static constexpr char PATTERN[] = "RZ*BZ*M";
+
+bool near(const Row &a, const Row &b) {
+    return std::abs(a.lat - b.lat) <= 0.02 && std::abs(a.lon - b.lon) <= 0.05;
+}
+
+struct GuardR {
+    static constexpr char var = 'R';
+
+    static bool check(const BindingView &, const Row &R) {
+        return R.primary_type == "ROBBERY";
+    }
+};
+
+struct GuardB {
+    static constexpr char var = 'B';
+
+    static bool check(const BindingView &bindings, const Row &B) {
+        return B.primary_type == "BATTERY" && near(B, *bindings.first('R'));
+    }
+};
+
+struct GuardM {
+    static constexpr char var = 'M';
+
+    static bool check(const BindingView &bindings, const Row &M) {
+        const Row &R = *bindings.first('R');
+        return M.primary_type == "MOTOR VEHICLE THEFT" && near(M, R) && M.datetime - R.datetime <= 30 * 60;
+    }
+};
+
+using Matcher = StaticMatcher<PATTERN, GuardR, GuardB, GuardM>;
+
+// same guards as the Matcher, as GuardFns
+NFA compile_guarded(const std::string &pattern) {
+    NFA nfa = parse(pattern);
+    for (State &state : nfa.states) {
+        if (state.out1.type == TransitionType::VAR) {
+            switch (state.out1.var) {
+                case 'R': state.out1.guard = GuardR::check; break;
+                case 'B': state.out1.guard = GuardB::check; break;
+                case 'M': state.out1.guard = GuardM::check; break;
+                default:  state.out1.guard = static_nfa::AnyRow::check; break;
+            }
+        }
+    }
+    return nfa;
+}
+
+// deterministic mix of crime types over a small area, one row a minute
+std::vector<Row> random_rows(int count) {
+    const char *types[] = {"ROBBERY", "BATTERY", "MOTOR VEHICLE THEFT", "THEFT", "ASSAULT", "NARCOTICS"};
+    const int weights[] = {3, 6, 3, 40, 30, 18};
+
+    std::vector<Row> rows;
+    uint32_t state = 12345;
+    auto next = [&state]() {
+        state = state * 1103515245u + 12345u;
+        return (state >> 8) % 100;
+    };
+    for (int i = 0; i < count; ++i) {
+        int pick = next();
+        int t = 0;
+        while (pick >= weights[t]) {
+            pick -= weights[t++];
+        }
+        float lat = 41.8f + next() * 0.0004f;
+        float lon = -87.7f + next() * 0.0008f;
+        rows.push_back({i, "1/2/2018 5:30", i * 60, types[t], lat, lon});
+    }
+    return rows;
+}
+
+using Key = std::vector<std::tuple<char, int, int>>;
+
+Key key(const Match &match) {
+    Key key;
+    for (const MatchSpan &span : match.spans) {
+        key.emplace_back(span.var, span.first_id, span.last_id);
+    }
+    return key;
+}
+
+// without limits both engines have to report exactly the same matches
+void check_equivalence(const NFA &nfa, const std::vector<Row> &rows) {
+    std::vector<Key> expected;
+    std::vector<Key> actual;
+
+    Simulation sim(nfa);
+    sim.trace = false;
+    sim.sink = [&](const Match &match) { expected.push_back(key(match)); };
+    Matcher matcher;
+    matcher.sink = [&](const Match &match) { actual.push_back(key(match)); };
+
+    for (const Row &row : rows) {
+        sim.push(row);
+        matcher.push(row);
+    }
+
+    std::sort(expected.begin(), expected.end());
+    std::sort(actual.begin(), actual.end());
+    CHECK(!expected.empty());
+    CHECK(expected == actual);
+}
+
+void check_limits(const std::vector<Row> &rows, ShedPolicy policy) {
+    Matcher matcher;
+    matcher.sink = [](const Match &) {};
+    matcher.maxRuns = 64;
+    matcher.memoryBudget = 256 * 1024;
+    matcher.shedPolicy = policy;
+
+    for (const Row &row : rows) {
+        matcher.push(row);
+        CHECK(matcher.currentRuns.size() <= matcher.maxRuns);
+    }
+    CHECK(matcher.shedCount > 0);
+}
+
+template <typename Engine>
+double seconds(Engine &engine, const std::vector<Row> &rows, size_t max_runs, size_t &matches) {
+    engine.sink = [&matches](const Match &) { matches++; };
+    engine.maxRuns = max_runs;
+
+    auto start = std::chrono::steady_clock::now();
+    for (const Row &row : rows) {
+        engine.push(row);
+    }
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// both engines deduplicate live runs with a linear scan, so with many live runs that scan dominates.
+// The same maxRuns is a tighter limit for the Simulation, which holds one run per Thompson state
+// where the static matcher holds one per Glushkov position, so match counts can differ once it sheds.
+void benchmark(const NFA &nfa, const std::vector<Row> &rows, size_t max_runs) {
+    size_t sim_matches = 0;
+    size_t static_matches = 0;
+
+    Simulation sim(nfa);
+    sim.trace = false;
+    double sim_time = seconds(sim, rows, max_runs, sim_matches);
+    Matcher matcher;
+    double static_time = seconds(matcher, rows, max_runs, static_matches);
+
+    std::cout << rows.size() << " rows, maxRuns " << max_runs << " per engine\n";
+    std::cout << "  Simulation:    " << sim_time * 1000 << " ms, " << sim_matches << " matches\n";
+    std::cout << "  StaticMatcher: " << static_time * 1000 << " ms, " << static_matches << " matches"
+              << " (" << sim_time / static_time << "x)\n";
+}
+
+int main() {
+    NFA nfa = compile_guarded(PATTERN);
+
+    check_equivalence(nfa, random_rows(600));
+    check_limits(random_rows(5000), ShedPolicy::OLDEST_FIRST);
+    check_limits(random_rows(5000), ShedPolicy::LOWEST_PROGRESS_FIRST);
+    check_limits(random_rows(5000), ShedPolicy::FARTHEST_FROM_ACCEPT);
+    std::cout << "static_matcher: ok\n";
+
+    std::vector<Row> rows = random_rows(20000);
+    benchmark(nfa, rows, 20);
+    benchmark(nfa, rows, 100);
+    benchmark(nfa, rows, 300);
+    return 0;
+}